@@ -0,0 +1,820 @@
+// Regression benchmark of the portable conversion core: runs a fixed corpus of synthetic
+// trees through extraction, welding, partitioning and meshlet building in the order
+// ExportTree applies them, hashes the resulting vertex and index streams and compares
+// hash, wall time and peak memory of every case against a golden file.
+//
+//   regression [--update] [--margin <fraction>] [--repeat <n>] [--case <name>] <golden file>
+//
+// Every case runs in a child process so that its peak memory can be measured on its own.
+
+#include "GeometryCache.h"
+#include "Meshlets.h"
+#include "Partition.h"
+#include "TreeGeometry.h"
+#include "Validation.h"
+#include "Weld.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// rand() differs between C libraries, the corpus must not
+class Random
+{
+public:
+  Random(unsigned int seed)
+    : State(seed)
+  {
+  }
+  unsigned int Next()
+  {
+    State = State * 1664525u + 1013904223u;
+    return State >> 8;
+  }
+  float Uniform(float lo, float hi)
+  {
+    return lo + (hi - lo) * (float)(Next() & 0xFFFF) / 65535.f;
+  }
+  int Index(int count)
+  {
+    return (int)(Next() % (unsigned int)count);
+  }
+
+private:
+  unsigned int State;
+};
+
+struct TreeSpec
+{
+  unsigned int Seed;
+  int Rings;        // branch and frond vertices come in rings of RingSize
+  int BranchStrips;
+  int FrondStrips;
+  int StripLength;
+  int Leaves;       // leaves of LOD 0, every further LOD has half as many
+  int Lods;
+  bool LeafMeshes;
+  bool Wind;
+};
+
+static const int RingSize = 8;
+
+// Ring directions as constants, libm's sin and cos may differ in the last bit
+static const float RingDirections[RingSize][2] = {
+  { 1.f, 0.f }, { 0.70710678f, 0.70710678f }, { 0.f, 1.f }, { -0.70710678f, 0.70710678f },
+  { -1.f, 0.f }, { -0.70710678f, -0.70710678f }, { 0.f, -1.f }, { 0.70710678f, -0.70710678f },
+};
+
+// Owns the arrays a TreeGeometry view points into, like SpeedTreeRT or a mapped cache would
+class SyntheticTree
+{
+public:
+  SyntheticTree(TreeSpec const &spec);
+
+  TreeGeometry Geometry;
+
+private:
+  SyntheticTree(SyntheticTree const&);
+  SyntheticTree &operator=(SyntheticTree const&);
+
+  struct IndexedStorage
+  {
+    std::vector<float> Coords, Normals, Binormals, Tangents, TexCoords, WindWeights[2];
+    std::vector<unsigned int> Colors;
+    std::vector<unsigned char> WindMatrixIndices[2];
+    std::vector<int> Strips;
+    std::vector<int> StripLengths;
+  };
+  struct LeafStorage
+  {
+    std::vector<float> Centers, Normals, Binormals, Tangents, Dimming, WindWeights[2];
+    std::vector<unsigned int> Colors;
+    std::vector<unsigned char> CardIndices, WindMatrixIndices[2];
+  };
+
+  void MakeIndexed(TreeSpec const &spec, int stripCount, float radius, Random &random, IndexedStorage &s, IndexedGeometry &g);
+  void MakeLeaves(TreeSpec const &spec, int lod, Random &random, LeafStorage &s, LeafLod &l);
+
+  std::string UserData;
+  IndexedStorage Branches;
+  IndexedStorage Fronds;
+  std::vector<LeafStorage> Leaves;
+  float CardCoords[3][16];
+  float CardTexCoords[3][8];
+  float MeshCoords[12];
+  float MeshNormals[12];
+  float MeshTexCoords[8];
+  int MeshIndices[12];
+};
+
+SyntheticTree::SyntheticTree(TreeSpec const &spec)
+{
+  Random random(spec.Seed);
+  UserData = "$b";
+  UserData += (char)4;
+  UserData += "bark";
+  UserData += "l";
+  UserData += (char)5;
+  UserData += "crown";
+  Geometry.UserData = UserData.c_str();
+  MakeIndexed(spec, spec.BranchStrips, 1.f, random, Branches, Geometry.Branches);
+  MakeIndexed(spec, spec.FrondStrips, 3.f, random, Fronds, Geometry.Fronds);
+
+  for (int card = 0; card < 3; ++card)
+  {
+    const float width = 0.5f + card * 0.25f;
+    const float corners[8] = {-1, -1, 1, -1, 1, 1, -1, 1};
+    for (int corner = 0; corner < 4; ++corner)
+    {
+      CardCoords[card][corner * 4] = 0.f;
+      CardCoords[card][corner * 4 + 1] = corners[corner * 2] * width * 0.5f;
+      CardCoords[card][corner * 4 + 2] = corners[corner * 2 + 1] * width * 0.5f;
+      CardCoords[card][corner * 4 + 3] = 0.f;
+      CardTexCoords[card][corner * 2] = corners[corner * 2] > 0 ? 1.f : 0.f;
+      CardTexCoords[card][corner * 2 + 1] = corners[corner * 2 + 1] > 0 ? 1.f : 0.f;
+    }
+  }
+  for (int i = 0; i < 12; ++i)
+  {
+    MeshCoords[i] = random.Uniform(-0.3f, 0.3f);
+    MeshNormals[i] = i % 3 == 2 ? 1.f : 0.f;
+  }
+  for (int i = 0; i < 8; ++i)
+  {
+    MeshTexCoords[i] = random.Uniform(0.f, 1.f);
+  }
+  const int indices[12] = {0, 1, 2, 0, 2, 3, 2, 1, 0, 3, 2, 0}; // double sided
+  memcpy(MeshIndices, indices, sizeof(indices));
+
+  Leaves.resize(spec.Lods);
+  for (int lod = 0; lod < spec.Lods; ++lod)
+  {
+    Geometry.Leaves.push_back(LeafLod());
+    MakeLeaves(spec, lod, random, Leaves[lod], Geometry.Leaves.back());
+  }
+}
+
+void SyntheticTree::MakeIndexed(TreeSpec const &spec, int stripCount, float radius, Random &random, IndexedStorage &s, IndexedGeometry &g)
+{
+  const int vertexCount = spec.Rings * RingSize;
+  for (int v = 0; v < vertexCount; ++v)
+  {
+    const int ring = v / RingSize;
+    const float r = radius * (1.f - 0.8f * ring / spec.Rings) + random.Uniform(-0.01f, 0.01f);
+    const float nx = RingDirections[v % RingSize][0], ny = RingDirections[v % RingSize][1];
+    const float coords[3] = {r * nx, r * ny, ring * 0.1f};
+    const float normal[3] = {nx, ny, 0.f};
+    const float binormal[3] = {0.f, 0.f, 1.f};
+    const float tangent[3] = {-ny, nx, 0.f};
+    s.Coords.insert(s.Coords.end(), coords, coords + 3);
+    s.Normals.insert(s.Normals.end(), normal, normal + 3);
+    s.Binormals.insert(s.Binormals.end(), binormal, binormal + 3);
+    s.Tangents.insert(s.Tangents.end(), tangent, tangent + 3);
+    s.TexCoords.push_back((float)(v % RingSize) / RingSize);
+    s.TexCoords.push_back(ring * 0.25f);
+    s.Colors.push_back(random.Next() | 0xFF000000u);
+    for (int level = 0; level < 2; ++level)
+    {
+      s.WindWeights[level].push_back(random.Uniform(0.f, 1.f));
+      s.WindMatrixIndices[level].push_back((unsigned char)random.Index(4));
+    }
+  }
+  // Strips zigzag between two neighbouring rings
+  for (int strip = 0; strip < stripCount; ++strip)
+  {
+    const int start = random.Index(vertexCount - spec.StripLength / 2 - RingSize - 1);
+    for (int i = 0; i < spec.StripLength; ++i)
+    {
+      s.Strips.push_back(start + i / 2 + (i % 2) * RingSize);
+    }
+    s.StripLengths.push_back(spec.StripLength);
+  }
+
+  g.VertexCount = vertexCount;
+  g.Coords = &s.Coords[0];
+  g.Normals = &s.Normals[0];
+  g.Binormals = &s.Binormals[0];
+  g.Tangents = &s.Tangents[0];
+  g.TexCoords = &s.TexCoords[0];
+  g.Colors = &s.Colors[0];
+  for (int level = 0; spec.Wind && level < 2; ++level)
+  {
+    g.WindWeights[level] = &s.WindWeights[level][0];
+    g.WindMatrixIndices[level] = &s.WindMatrixIndices[level][0];
+  }
+  for (int lod = 0; lod < spec.Lods; ++lod)
+  {
+    IndexedLod l;
+    l.StripCount = stripCount >> lod ? stripCount >> lod : 1;
+    l.StripLengths = &s.StripLengths[0];
+    for (int strip = 0; strip < l.StripCount; ++strip)
+    {
+      l.Strips.push_back(&s.Strips[strip * spec.StripLength]);
+    }
+    g.Lods.push_back(l);
+  }
+}
+
+void SyntheticTree::MakeLeaves(TreeSpec const &spec, int lod, Random &random, LeafStorage &s, LeafLod &l)
+{
+  const int leafCount = spec.Leaves >> lod;
+  const int cardCount = spec.LeafMeshes ? 3 : 2;
+  for (int leaf = 0; leaf < leafCount; ++leaf)
+  {
+    const float height = random.Uniform(0.3f, 1.f) * spec.Rings * 0.1f;
+    const float spread = 2.f + height;
+    s.Centers.push_back(random.Uniform(-spread, spread));
+    s.Centers.push_back(random.Uniform(-spread, spread));
+    s.Centers.push_back(height);
+    for (int corner = 0; corner < 4; ++corner)
+    {
+      const float normal[3] = {random.Uniform(-1.f, 1.f), random.Uniform(-1.f, 1.f), 1.f};
+      s.Normals.insert(s.Normals.end(), normal, normal + 3);
+      s.Binormals.push_back(0.f);
+      s.Binormals.push_back(1.f);
+      s.Binormals.push_back(0.f);
+      s.Tangents.push_back(1.f);
+      s.Tangents.push_back(0.f);
+      s.Tangents.push_back(0.f);
+      s.Colors.push_back(random.Next() | 0xFF000000u);
+    }
+    s.Dimming.push_back(random.Uniform(0.5f, 1.f));
+    s.CardIndices.push_back((unsigned char)random.Index(cardCount));
+    for (int level = 0; level < 2; ++level)
+    {
+      s.WindWeights[level].push_back(random.Uniform(0.f, 1.f));
+      s.WindMatrixIndices[level].push_back((unsigned char)random.Index(4));
+    }
+  }
+
+  l.LeafCount = leafCount;
+  if (!leafCount)
+  {
+    return;
+  }
+  l.Centers = &s.Centers[0];
+  l.Normals = &s.Normals[0];
+  l.Binormals = &s.Binormals[0];
+  l.Tangents = &s.Tangents[0];
+  l.Colors = &s.Colors[0];
+  l.Dimming = &s.Dimming[0];
+  l.CardIndices = &s.CardIndices[0];
+  for (int level = 0; spec.Wind && level < 2; ++level)
+  {
+    l.WindWeights[level] = &s.WindWeights[level][0];
+    l.WindMatrixIndices[level] = &s.WindMatrixIndices[level][0];
+  }
+  for (int card = 0; card < cardCount; ++card)
+  {
+    LeafCard c;
+    c.Width = 0.5f + card * 0.25f;
+    c.Height = c.Width;
+    c.Pivot[0] = 0.5f;
+    c.Pivot[1] = 0.5f;
+    c.Coords = CardCoords[card];
+    c.TexCoords = CardTexCoords[card];
+    c.Mesh = card == 2 ? 0 : -1;
+    l.Cards.push_back(c);
+  }
+  if (spec.LeafMeshes)
+  {
+    LeafMesh m;
+    m.VertexCount = 4;
+    m.Coords = MeshCoords;
+    m.Normals = m.Binormals = m.Tangents = MeshNormals;
+    m.TexCoords = MeshTexCoords;
+    m.IndexCount = 12;
+    m.Indices = MeshIndices;
+    l.Meshes.push_back(m);
+  }
+}
+
+// FNV-1a over little-endian values, so the hash doesn't depend on the host
+class Hasher
+{
+public:
+  Hasher()
+    : Value(14695981039346656037ULL)
+  {
+  }
+  void Add(unsigned long long bits, int bytes)
+  {
+    for (int i = 0; i < bytes; ++i)
+    {
+      Value = (Value ^ ((bits >> (i * 8)) & 0xFF)) * 1099511628211ULL;
+    }
+  }
+  void Add(int v) { Add((unsigned long long)(unsigned int)v, 4); }
+  void Add(unsigned int v) { Add((unsigned long long)v, 4); }
+  void Add(unsigned char v) { Add((unsigned long long)v, 1); }
+  void Add(float v)
+  {
+    unsigned int bits;
+    memcpy(&bits, &v, sizeof(bits));
+    Add((unsigned long long)bits, 4);
+  }
+  void Add(double v)
+  {
+    unsigned long long bits;
+    memcpy(&bits, &v, sizeof(bits));
+    Add(bits, 8);
+  }
+  void Add(std::string const &s)
+  {
+    Add((unsigned int)s.size());
+    for (size_t i = 0; i < s.size(); ++i)
+    {
+      Add((unsigned char)s[i]);
+    }
+  }
+  // Streams are prefixed with their size, so an empty channel differs from a missing one
+  template<typename T>
+  void Add(std::vector<T> const &v)
+  {
+    Add((unsigned int)v.size());
+    for (size_t i = 0; i < v.size(); ++i)
+    {
+      Add(v[i]);
+    }
+  }
+  unsigned long long Value;
+};
+
+static void HashMesh(TreeMesh const &m, Hasher &h)
+{
+  h.Add(m.Attributes);
+  h.Add(m.Positions);
+  h.Add(m.Normals);
+  h.Add(m.Binormals);
+  h.Add(m.Tangents);
+  h.Add(m.Colors);
+  for (int uv = 0; uv < UVSetCount; ++uv)
+  {
+    h.Add(m.UVs[uv]);
+  }
+  h.Add(m.Wind);
+  h.Add(m.Indices);
+  h.Add(m.Materials);
+  h.Add(m.Groups);
+  h.Add(m.Elements);
+  h.Add(m.Sections);
+  h.Add(m.MaterialNames);
+  h.Add(m.LeafCenters);
+}
+
+static void HashMeshlets(MeshletSet const &set, Hasher &h)
+{
+  h.Add((unsigned int)set.Meshlets.size());
+  for (size_t i = 0; i < set.Meshlets.size(); ++i)
+  {
+    Meshlet const &m = set.Meshlets[i];
+    const unsigned int fields[6] = {m.VertexOffset, m.VertexCount, m.TriangleOffset, m.TriangleCount, m.Material, m.Part};
+    for (int k = 0; k < 6; ++k)
+    {
+      h.Add(fields[k]);
+    }
+    for (int k = 0; k < 3; ++k)
+    {
+      h.Add(m.Center[k]);
+      h.Add(m.ConeApex[k]);
+      h.Add(m.ConeAxis[k]);
+    }
+    h.Add(m.Radius);
+    h.Add(m.ConeCutoff);
+  }
+  h.Add(set.Vertices);
+  h.Add(set.Triangles);
+}
+
+struct Case
+{
+  Case(const char *name, int tree)
+    : Name(name)
+    , Tree(tree)
+    , Weld(false)
+    , Meshlets(false)
+    , Cache(false)
+  {
+  }
+  const char *Name;
+  int Tree;               // index into Trees
+  ExtractOptions Extract;
+  bool Weld;
+  PartitionOptions Partition;
+  bool Meshlets;
+  bool Cache;             // go through a geometry cache file first
+};
+
+static const TreeSpec Trees[] = {
+  // seed, rings, branch strips, frond strips, strip length, leaves, LODs, leaf meshes, wind
+  { 1, 64, 40, 20, 24, 800, 3, false, false },
+  { 2, 1024, 600, 300, 48, 40000, 3, true, true },
+  { 3, 8192, 3000, 1500, 64, 160000, 2, true, true },
+};
+
+static std::vector<Case> MakeCases()
+{
+  std::vector<Case> cases;
+  cases.push_back(Case("sapling", 0));
+  cases.push_back(Case("oak", 1));
+  cases.push_back(Case("oak-threads", 1));
+  cases.back().Extract.Threads = 4;
+  cases.push_back(Case("oak-minimal", 1));
+  ParseAttributes("minimal", cases.back().Extract.Attributes);
+  cases.push_back(Case("oak-wind", 1));
+  cases.back().Extract.Attributes |= AttrWind;
+  cases.push_back(Case("oak-lod2-leaves", 1));
+  cases.back().Extract.Lod = 2;
+  ParseSections("leaves", cases.back().Extract.Sections);
+  cases.push_back(Case("oak-weld", 1));
+  cases.back().Weld = true;
+  cases.push_back(Case("oak-split", 1));
+  cases.back().Partition.Leaves = true;
+  cases.back().Partition.Fronds = true;
+  cases.push_back(Case("oak-meshlets", 1));
+  cases.back().Meshlets = true;
+  cases.push_back(Case("oak-cache", 1));
+  cases.back().Cache = true;
+  cases.push_back(Case("forest", 2));
+  cases.push_back(Case("forest-threads", 2));
+  cases.back().Extract.Threads = 4;
+  cases.push_back(Case("forest-full", 2));
+  cases.back().Weld = true;
+  cases.back().Partition.Leaves = true;
+  cases.back().Meshlets = true;
+  return cases;
+}
+
+struct Measurement
+{
+  unsigned long long Hash;
+  int Vertices;
+  int Triangles;
+  double Ms;
+  long PeakKb;
+  char Error[128];
+};
+
+static double NowMs()
+{
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000. + t.tv_nsec / 1000000.;
+}
+
+// The mesh pipeline of ExportTree without the FBX scene: the streams hashed here are
+// the ones GenerateTree copies into the FBX mesh
+static bool RunPipeline(TreeGeometry const &geometry, Case const &c, Measurement &result)
+{
+  TreeMesh mesh;
+  if (!ExtractTree(geometry, c.Extract, mesh))
+  {
+    strcpy(result.Error, "extraction failed");
+    return false;
+  }
+  if (c.Weld)
+  {
+    WeldVertices(mesh, 0.);
+  }
+  MeshStats stats;
+  ValidateMesh(mesh, stats);
+  std::vector<std::string> problems;
+  DescribeProblems(stats, problems);
+  if (!problems.empty())
+  {
+    snprintf(result.Error, sizeof(result.Error), "%s", problems[0].c_str());
+    return false;
+  }
+
+  Hasher h;
+  MeshletSet meshlets;
+  result.Vertices = 0;
+  result.Triangles = 0;
+  if (!c.Partition.Leaves && !c.Partition.Fronds)
+  {
+    HashMesh(mesh, h);
+    if (c.Meshlets)
+    {
+      BuildMeshlets(mesh, 0, MeshletOptions(), meshlets);
+    }
+    result.Vertices = mesh.GetVertexCount();
+    result.Triangles = mesh.GetTriangleCount();
+  }
+  else
+  {
+    std::vector<MeshPart> parts;
+    PartitionMesh(mesh, c.Partition, parts);
+    for (size_t i = 0; i < parts.size(); ++i)
+    {
+      h.Add(parts[i].Suffix);
+      h.Add(parts[i].MaterialIds);
+      HashMesh(parts[i].Mesh, h);
+      if (c.Meshlets)
+      {
+        BuildMeshlets(parts[i].Mesh, (unsigned int)i, MeshletOptions(), meshlets);
+      }
+      result.Vertices += parts[i].Mesh.GetVertexCount();
+      result.Triangles += parts[i].Mesh.GetTriangleCount();
+    }
+  }
+  HashMeshlets(meshlets, h);
+  result.Hash = h.Value;
+  return true;
+}
+
+static bool RunCase(Case const &c, int repeat, Measurement &result)
+{
+  SyntheticTree tree(Trees[c.Tree]);
+  std::wstring cachePath;
+  if (c.Cache)
+  {
+    char name[] = "/tmp/regressionXXXXXX";
+    const int fd = mkstemp(name);
+    FILE *f = fd == -1 ? NULL : fdopen(fd, "wb");
+    const bool written = f && WriteGeometryCache(f, tree.Geometry);
+    if (f)
+    {
+      fclose(f);
+    }
+    cachePath.assign(name, name + strlen(name));
+    if (!written)
+    {
+      strcpy(result.Error, "failed to write the cache");
+      return false;
+    }
+  }
+
+  bool ok = true;
+  result.Ms = 0.;
+  for (int run = 0; ok && run < repeat; ++run)
+  {
+    const double start = NowMs();
+    if (c.Cache)
+    {
+      GeometryCache cache;
+      std::string error;
+      ok = cache.Open(cachePath, error);
+      if (!ok)
+      {
+        snprintf(result.Error, sizeof(result.Error), "%s", error.c_str());
+      }
+      ok = ok && RunPipeline(cache.GetGeometry(), c, result);
+    }
+    else
+    {
+      ok = RunPipeline(tree.Geometry, c, result);
+    }
+    const double ms = NowMs() - start;
+    result.Ms = run ? std::min(result.Ms, ms) : ms;
+  }
+  if (c.Cache)
+  {
+    std::string name(cachePath.begin(), cachePath.end());
+    unlink(name.c_str());
+  }
+  return ok;
+}
+
+// Runs a case in a child process and reports its peak resident memory
+static bool MeasureCase(Case const &c, int repeat, Measurement &result)
+{
+  memset(&result, 0, sizeof(result));
+  int fds[2];
+  if (pipe(fds))
+  {
+    strcpy(result.Error, "pipe failed");
+    return false;
+  }
+  fflush(stdout);
+  const pid_t pid = fork();
+  if (pid == 0)
+  {
+    close(fds[0]);
+    const bool ok = RunCase(c, repeat, result);
+    const bool sent = write(fds[1], &result, sizeof(result)) == (ssize_t)sizeof(result);
+    _exit(ok && sent ? EXIT_SUCCESS : EXIT_FAILURE);
+  }
+  close(fds[1]);
+  if (pid == -1)
+  {
+    close(fds[0]);
+    strcpy(result.Error, "fork failed");
+    return false;
+  }
+  const bool received = read(fds[0], &result, sizeof(result)) == (ssize_t)sizeof(result);
+  close(fds[0]);
+  int status = 0;
+  rusage usage;
+  memset(&usage, 0, sizeof(usage));
+  wait4(pid, &status, 0, &usage);
+  if (!received)
+  {
+    strcpy(result.Error, "the case crashed");
+    return false;
+  }
+  result.PeakKb = usage.ru_maxrss;
+  return WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+struct Golden
+{
+  unsigned long long Hash;
+  int Vertices;
+  int Triangles;
+  double Ms;
+  long PeakKb;
+};
+
+// One case per line: name, hash, vertices, triangles, time budget in ms, peak memory budget in KB
+static bool ReadGolden(const char *path, std::map<std::string, Golden> &golden)
+{
+  FILE *f = fopen(path, "r");
+  if (!f)
+  {
+    return false;
+  }
+  char line[512];
+  while (fgets(line, sizeof(line), f))
+  {
+    char name[128];
+    Golden g;
+    if (line[0] != '#' && sscanf(line, "%127s %llx %d %d %lf %ld", name, &g.Hash, &g.Vertices, &g.Triangles, &g.Ms, &g.PeakKb) == 6)
+    {
+      golden[name] = g;
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+static bool WriteGolden(const char *path, std::map<std::string, Golden> const &golden)
+{
+  FILE *f = fopen(path, "w");
+  if (!f)
+  {
+    return false;
+  }
+  fprintf(f, "# Written by regression --update. Budgets are the measurements of the machine that wrote them.\n");
+  fprintf(f, "# name hash vertices triangles ms peak_kb\n");
+  for (std::map<std::string, Golden>::const_iterator it = golden.begin(); it != golden.end(); ++it)
+  {
+    Golden const &g = it->second;
+    fprintf(f, "%s %016llx %d %d %.1f %ld\n", it->first.c_str(), g.Hash, g.Vertices, g.Triangles, g.Ms, g.PeakKb);
+  }
+  return fclose(f) == 0;
+}
+
+static void PrintUsage()
+{
+  printf("Usage: regression [options] <golden file>\n"
+    "  --update             Record hashes and budgets of this machine in the golden file\n"
+    "  --margin <fraction>  Allowed excess over the time and memory budgets (default 0.25)\n"
+    "  --repeat <n>         Runs per case, the fastest one counts (default 3)\n"
+    "  --case <name>        Run only this case\n");
+}
+
+int main(int argc, char *argv[])
+{
+  bool update = false;
+  double margin = 0.25;
+  int repeat = 3;
+  const char *only = NULL;
+  const char *goldenPath = NULL;
+  for (int idx = 1; idx < argc; ++idx)
+  {
+    const std::string arg(argv[idx]);
+    const bool hasValue = idx + 1 < argc;
+    if (arg == "--update")
+    {
+      update = true;
+    }
+    else if (arg == "--margin" && hasValue)
+    {
+      margin = atof(argv[++idx]);
+    }
+    else if (arg == "--repeat" && hasValue)
+    {
+      repeat = std::max(atoi(argv[++idx]), 1);
+    }
+    else if (arg == "--case" && hasValue)
+    {
+      only = argv[++idx];
+    }
+    else if (arg.compare(0, 2, "--") == 0 || goldenPath)
+    {
+      PrintUsage();
+      return EXIT_FAILURE;
+    }
+    else
+    {
+      goldenPath = argv[idx];
+    }
+  }
+  if (!goldenPath)
+  {
+    PrintUsage();
+    return EXIT_FAILURE;
+  }
+
+  std::map<std::string, Golden> golden;
+  if (!ReadGolden(goldenPath, golden) && !update)
+  {
+    fprintf(stderr, "Failed to read: %s\n", goldenPath);
+    return EXIT_FAILURE;
+  }
+
+  const std::vector<Case> cases = MakeCases();
+  bool found = !only;
+  for (size_t i = 0; i < cases.size(); ++i)
+  {
+    found = found || !strcmp(only, cases[i].Name);
+  }
+  if (!found)
+  {
+    fprintf(stderr, "Unknown case: %s\n", only);
+    return EXIT_FAILURE;
+  }
+
+  int failed = 0;
+  int ran = 0;
+  printf("%-16s %-16s %9s %9s %18s %22s\n", "case", "hash", "vertices", "triangles", "ms (budget)", "peak KB (budget)");
+  for (size_t i = 0; i < cases.size(); ++i)
+  {
+    Case const &c = cases[i];
+    if (only && strcmp(only, c.Name))
+    {
+      continue;
+    }
+    ran++;
+    Measurement m;
+    if (!MeasureCase(c, repeat, m))
+    {
+      printf("%-16s FAILED: %s\n", c.Name, m.Error[0] ? m.Error : "the case crashed");
+      failed++;
+      continue;
+    }
+
+    std::string verdict;
+    std::map<std::string, Golden>::iterator it = golden.find(c.Name);
+    if (update)
+    {
+      Golden &g = golden[c.Name];
+      g.Hash = m.Hash;
+      g.Vertices = m.Vertices;
+      g.Triangles = m.Triangles;
+      g.Ms = m.Ms;
+      g.PeakKb = m.PeakKb;
+      verdict = "recorded";
+    }
+    else if (it == golden.end())
+    {
+      verdict = "FAILED: no golden value, run with --update";
+    }
+    else
+    {
+      Golden const &g = it->second;
+      // 1 ms of slack keeps timer noise from failing the small cases
+      if (m.Hash != g.Hash || m.Vertices != g.Vertices || m.Triangles != g.Triangles)
+      {
+        verdict = "FAILED: geometry changed";
+      }
+      else if (m.Ms > g.Ms * (1. + margin) + 1.)
+      {
+        verdict = "FAILED: slower than the budget";
+      }
+      else if (m.PeakKb > g.PeakKb * (1. + margin))
+      {
+        verdict = "FAILED: more memory than the budget";
+      }
+      else
+      {
+        verdict = "ok";
+      }
+    }
+    failed += verdict.compare(0, 6, "FAILED") == 0;
+
+    char ms[32], kb[32];
+    const bool known = it != golden.end() && !update;
+    snprintf(ms, sizeof(ms), known ? "%.1f (%.1f)" : "%.1f", m.Ms, known ? it->second.Ms : 0.);
+    snprintf(kb, sizeof(kb), known ? "%ld (%ld)" : "%ld", m.PeakKb, known ? it->second.PeakKb : 0L);
+    printf("%-16s %016llx %9d %9d %18s %22s  %s\n", c.Name, m.Hash, m.Vertices, m.Triangles, ms, kb, verdict.c_str());
+  }
+
+  if (update && !WriteGolden(goldenPath, golden))
+  {
+    fprintf(stderr, "Failed to write: %s\n", goldenPath);
+    return EXIT_FAILURE;
+  }
+  printf("%d of %d cases failed\n", failed, ran);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
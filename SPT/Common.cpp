@@ -47,15 +47,37 @@ const char *extension(const char *filename) {
   return dot + 1;
 }
 
+unsigned long long FileSize(std::wstring const &path)
+{
+  WIN32_FILE_ATTRIBUTE_DATA data;
+  if (!GetFileAttributesExW(path.c_str(), GetFileExInfoStandard, &data))
+  {
+    return 0;
+  }
+  return ((unsigned long long)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+}
 
-void InitializeSdkObjects(FbxManager*& pManager, FbxScene*& pScene)
+double GetTimeMs()
+{
+  static LARGE_INTEGER frequency;
+  if (!frequency.QuadPart)
+  {
+    QueryPerformanceFrequency(&frequency);
+  }
+  LARGE_INTEGER now;
+  QueryPerformanceCounter(&now);
+  return (double)now.QuadPart * 1000. / (double)frequency.QuadPart;
+}
+
+
+FbxManager *CreateSdkManager()
 {
   //The first thing to do is to create the FBX Manager which is the object allocator for almost all the classes in the SDK
-  pManager = FbxManager::Create();
+  FbxManager *pManager = FbxManager::Create();
   if( !pManager )
   {
     FBXSDK_printf("Error: Unable to create FBX Manager!\n");
-    return;
+    return NULL;
   }
   
   //Create an IOSettings object. This object holds all import/export settings.
@@ -65,19 +87,34 @@ void InitializeSdkObjects(FbxManager*& pManager, FbxScene*& pScene)
   //Load plugins from the executable directory (optional)
   FbxString lPath = FbxGetApplicationDirectory();
   pManager->LoadPluginsDirectory(lPath.Buffer());
-  
+  return pManager;
+}
+
+FbxScene *CreateScene(FbxManager* pManager)
+{
   //Create an FBX scene. This object holds most objects imported/exported from/to files.
-  pScene = FbxScene::Create(pManager, "");
+  FbxScene *pScene = FbxScene::Create(pManager, "");
   if( !pScene )
   {
     FBXSDK_printf("Error: Unable to create FBX scene!\n");
-    return;
+    return NULL;
   }
   FbxAxisSystem::EFrontVector FrontVector = (FbxAxisSystem::EFrontVector)-FbxAxisSystem::eParityOdd;
   const FbxAxisSystem UnrealZUp(FbxAxisSystem::eZAxis,FrontVector,FbxAxisSystem::eRightHanded);
   pScene->GetGlobalSettings().SetAxisSystem(UnrealZUp);
   pScene->GetGlobalSettings().SetOriginalUpAxis(UnrealZUp);
   pScene->GetGlobalSettings().SetSystemUnit(FbxSystemUnit::cm);
+  return pScene;
+}
+
+void InitializeSdkObjects(FbxManager*& pManager, FbxScene*& pScene)
+{
+  pScene = NULL;
+  pManager = CreateSdkManager();
+  if( pManager )
+  {
+    pScene = CreateScene(pManager);
+  }
 }
 
 void DestroySdkObjects(FbxManager* pManager)
@@ -86,6 +123,21 @@ void DestroySdkObjects(FbxManager* pManager)
   if( pManager ) pManager->Destroy();
 }
 
+int FindWriterFormat(FbxManager* pManager, const char* pDescription)
+{
+  FbxIOPluginRegistry *lRegistry = pManager->GetIOPluginRegistry();
+  int lFormatCount = lRegistry->GetWriterFormatCount();
+  for (int lFormatIndex = 0; lFormatIndex < lFormatCount; lFormatIndex++)
+  {
+    FbxString lDesc = lRegistry->GetWriterFormatDescription(lFormatIndex);
+    if (lDesc.GetLen() && lDesc.Find(pDescription) >= 0)
+    {
+      return lFormatIndex;
+    }
+  }
+  return -1;
+}
+
 bool SaveScene(FbxManager* pManager, FbxDocument* pScene, const char* pFilename, int pFileFormat, bool pEmbedMedia)
 {
   int lMajor, lMinor, lRevision;
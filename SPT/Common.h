@@ -17,10 +17,20 @@
 std::string w2a(const std::wstring &wstr);
 std::wstring a2w(const std::string &str);
 
+// Returns 0 if the file doesn't exist
+unsigned long long FileSize(std::wstring const &path);
+
+// Milliseconds from an arbitrary origin, for measuring intervals only
+double GetTimeMs();
+
+FbxManager *CreateSdkManager();
+FbxScene *CreateScene(FbxManager* pManager);
 void InitializeSdkObjects(FbxManager*& pManager, FbxScene*& pScene);
 void DestroySdkObjects(FbxManager* pManager);
 void CreateAndFillIOSettings(FbxManager* pManager);
 
+// Returns the index of the first writer whose description contains pDescription, or -1
+int FindWriterFormat(FbxManager* pManager, const char* pDescription);
 bool SaveScene(FbxManager* pManager, FbxDocument* pScene, const char* pFilename, int pFileFormat=-1, bool pEmbedMedia=false);
 bool LoadScene(FbxManager* pManager, FbxDocument* pScene, const char* pFilename);
 
@@ -1,6 +1,9 @@
 #include "Common.h"
 #include "Export.h"
+#include "GeometryCache.h"
+#include "Thread.h"
 
+#include <SpeedTreeRT.h>
 #include <algorithm>
 #include <iostream>
 #include <vector>
@@ -12,7 +15,6 @@ struct TreeStorage
     SdkManager = NULL;
     Scene = NULL;
     Mesh = NULL;
-    Lod = 0;
   }
   FbxManager  *SdkManager;
 	FbxScene    *Scene;
@@ -20,112 +22,127 @@ struct TreeStorage
   FbxNode     *MeshNode;
   FbxMesh     *Mesh;
 
-  int Lod;
+  std::vector<FbxSurfaceMaterial*> Materials;
 };
 
-inline FbxVector4 CPos(double x, double y, double z)
+static void GetIndexedGeometry(CSpeedTreeRT::SGeometry::SIndexed const &s, IndexedGeometry &g)
 {
-  return FbxVector4(x, -y, z);
-}
-
-inline FbxVector4 CNorm(double x, double y, double z)
-{
-  return FbxVector4(x, -y, z);
-}
-
-inline FbxVector4 CBiNorm(double x, double y, double z)
-{
-  return FbxVector4(x, -y, z);
-}
-
-inline FbxVector4 CTang(double x, double y, double z)
-{
-  return FbxVector4(x, -y, z);
+  g.VertexCount = s.m_nNumVertices;
+  g.Coords = s.m_pCoords;
+  g.Normals = s.m_pNormals;
+  g.Binormals = s.m_pBinormals;
+  g.Tangents = s.m_pTangents;
+  g.TexCoords = s.m_pTexCoords[CSpeedTreeRT::TL_DIFFUSE];
+  g.Colors = s.m_pColors;
+  for (int i = 0; i < 2; ++i)
+  {
+    g.WindWeights[i] = s.m_pWindWeights[i];
+    g.WindMatrixIndices[i] = s.m_pWindMatrixIndices[i];
+  }
+  if (!s.m_pNumStrips)
+  {
+    return;
+  }
+  for (int lod = 0; lod < s.m_nNumLods; ++lod)
+  {
+    IndexedLod l;
+    l.StripCount = s.m_pNumStrips[lod];
+    l.StripLengths = s.m_pStripLengths[lod];
+    l.Strips.assign(s.m_pStrips[lod], s.m_pStrips[lod] + l.StripCount);
+    g.Lods.push_back(l);
+  }
 }
 
-
-bool GenerateTree(CSpeedTreeRT *tree, TreeStorage &o)
+// Points the view at SpeedTreeRT's buffers, it stays valid while tree and sg are alive.
+// Only the requested sections are fetched, leaf LODs other than leafLod (-1: all) stay empty.
+static void GetTreeGeometry(CSpeedTreeRT *tree, unsigned int sections, int leafLod, CSpeedTreeRT::SGeometry &sg, TreeGeometry &g)
 {
-  // SIndexed geometry contains vertices for all LODs.
-  // We need to keep vertices of the current LOD only.
-  int totalVerticesCount = 0;
-  std::vector<int> uniqueBranchIndices;
-  std::vector<int> uniqueFrondIndices;
-
-  CSpeedTreeRT::SGeometry geometry;
-  tree->GetGeometry(geometry);
+  const bool branches = (sections & SectionBit(SectionBranches)) != 0;
+  const bool fronds = (sections & SectionBit(SectionFronds)) != 0;
+  const bool leaves = (sections & (SectionBit(SectionLeafCards) | SectionBit(SectionLeafMeshes))) != 0;
+  tree->GetGeometry(sg, (branches ? SpeedTree_BranchGeometry : 0) | (fronds ? SpeedTree_FrondGeometry : 0) | (leaves ? SpeedTree_LeafGeometry : 0));
+  g.UserData = tree->GetUserData();
+  if (branches)
+  {
+    GetIndexedGeometry(sg.m_sBranches, g.Branches);
+  }
+  if (fronds)
+  {
+    GetIndexedGeometry(sg.m_sFronds, g.Fronds);
+  }
+  for (int lod = 0; leaves && lod < tree->GetNumLeafLodLevels(); ++lod)
   {
-    if (geometry.m_sBranches.m_nNumLods > o.Lod && geometry.m_sBranches.m_pNumStrips)
+    g.Leaves.push_back(LeafLod());
+    if (leafLod != -1 && lod != leafLod)
     {
-      CSpeedTreeRT::SGeometry::SIndexed const *s = &geometry.m_sBranches;
-      for(int strip = 0; strip < s->m_pNumStrips[o.Lod]; ++strip)
-      {
-        const int length = s->m_pStripLengths[o.Lod][strip];
-        const int *indices = s->m_pStrips[o.Lod][strip];
-
-        for(int i = 0; i < length - 2; ++i)
-        {
-          for (int j = 0; j < 3; ++j)
-          {
-            int idx = indices[i + j];
-            if (std::find(uniqueBranchIndices.begin(), uniqueBranchIndices.end(), idx) == uniqueBranchIndices.end())
-            {
-              uniqueBranchIndices.push_back(idx);
-            }
-          }
-        }
-      }
-      totalVerticesCount += (int)uniqueBranchIndices.size();
+      continue;
     }
-
-    if (geometry.m_sFronds.m_nNumLods > o.Lod && geometry.m_sFronds.m_pNumStrips)
+    CSpeedTreeRT::SGeometry::SLeaf const &s = sg.m_pLeaves[lod];
+    LeafLod &l = g.Leaves.back();
+    l.LeafCount = s.m_nNumLeaves;
+    l.Centers = s.m_pCenterCoords;
+    l.Normals = s.m_pNormals;
+    l.Binormals = s.m_pBinormals;
+    l.Tangents = s.m_pTangents;
+    l.Colors = s.m_pColors;
+    l.Dimming = s.m_pDimming;
+    l.CardIndices = s.m_pLeafCardIndices;
+    for (int i = 0; i < 2; ++i)
     {
-      CSpeedTreeRT::SGeometry::SIndexed const *s = &geometry.m_sFronds;
-      for(int strip = 0; strip < s->m_pNumStrips[o.Lod]; ++strip)
-      {
-        const int length = s->m_pStripLengths[o.Lod][strip];
-        const int *indices = s->m_pStrips[o.Lod][strip];
-
-        for(int i = 0; i < length - 2; ++i)
-        {
-          for (int j = 0; j < 3; ++j)
-          {
-            int idx = indices[i + j];
-            if (std::find(uniqueFrondIndices.begin(), uniqueFrondIndices.end(), idx) == uniqueFrondIndices.end())
-            {
-              uniqueFrondIndices.push_back(idx);
-            }
-          }
-        }
-      }
-      totalVerticesCount += (int)uniqueFrondIndices.size();
+      l.WindWeights[i] = s.m_pWindWeights[i];
+      l.WindMatrixIndices[i] = s.m_pWindMatrixIndices[i];
     }
 
-    if (tree->GetNumLeafLodLevels() > o.Lod)
+    // Cards are only reachable through the leaves, meshes may be shared by cards
+    int cardCount = 0;
+    for (int leaf = 0; leaf < l.LeafCount; ++leaf)
+    {
+      cardCount = std::max(cardCount, (int)l.CardIndices[leaf] + 1);
+    }
+    std::vector<const CSpeedTreeRT::SGeometry::SLeaf::SMesh *> meshes;
+    for (int i = 0; i < cardCount; ++i)
     {
-      CSpeedTreeRT::SGeometry::SLeaf *s = &geometry.m_pLeaves[o.Lod];
-      int leafCount = s->m_nNumLeaves;
-      for (int leaf = 0; leaf < leafCount; ++leaf)
+      CSpeedTreeRT::SGeometry::SLeaf::SCard const &card = s.m_pCards[i];
+      LeafCard c;
+      c.Width = card.m_fWidth;
+      c.Height = card.m_fHeight;
+      c.Pivot[0] = card.m_afPivotPoint[0];
+      c.Pivot[1] = card.m_afPivotPoint[1];
+      c.Coords = card.m_pCoords;
+      c.TexCoords = card.m_pTexCoords;
+      c.Mesh = -1;
+      if (card.m_pMesh)
       {
-        const CSpeedTreeRT::SGeometry::SLeaf::SCard *card = &s->m_pCards[s->m_pLeafCardIndices[leaf]];
-        if (card->m_pMesh)
+        c.Mesh = (int)(std::find(meshes.begin(), meshes.end(), card.m_pMesh) - meshes.begin());
+        if (c.Mesh == (int)meshes.size())
         {
-          totalVerticesCount += card->m_pMesh->m_nNumVertices;
-        }
-        else
-        {
-          totalVerticesCount += 4;
+          const CSpeedTreeRT::SGeometry::SLeaf::SMesh *mesh = card.m_pMesh;
+          LeafMesh m;
+          m.VertexCount = mesh->m_nNumVertices;
+          m.Coords = mesh->m_pCoords;
+          m.Normals = mesh->m_pNormals;
+          m.Binormals = mesh->m_pBinormals;
+          m.Tangents = mesh->m_pTangents;
+          m.TexCoords = mesh->m_pTexCoords;
+          m.IndexCount = mesh->m_nNumIndices;
+          m.Indices = mesh->m_pIndices;
+          meshes.push_back(mesh);
+          l.Meshes.push_back(m);
         }
       }
+      l.Cards.push_back(c);
     }
   }
+}
 
+// materialIds maps the mesh's material indices to TreeStorage::Materials, NULL for identity
+bool GenerateTree(TreeMesh const &m, std::vector<int> const *materialIds, TreeStorage &o)
+{
   // Begin to build the mesh
 
-  o.Mesh->InitControlPoints(totalVerticesCount);
+  const int vertexCount = m.GetVertexCount();
+  o.Mesh->InitControlPoints(vertexCount);
   FbxVector4 *controlPoints = o.Mesh->GetControlPoints();
-  int offset = 0;
-  int group = 0;
 
   FbxLayer *layer = o.Mesh->GetLayer(0);
   if (!layer)
@@ -143,365 +160,302 @@ bool GenerateTree(CSpeedTreeRT *tree, TreeStorage &o)
   matLayer->SetReferenceMode(FbxLayerElement::eIndexToDirect);
   layer->SetMaterials(matLayer);
 
-  int branchMatIdx = -1;
-  int frondMatIdx = -1;
-  int leafMatIdx = -1;
-  const char *uData = tree->GetUserData();
-  if (uData && uData[0] == '$') // Real Editor's material mapping for UE4 import
+  for (size_t i = 0; i < m.MaterialNames.size(); ++i)
+  {
+    o.MeshNode->AddMaterial(o.Materials[materialIds ? (*materialIds)[i] : i]);
+  }
+
+  // Layer elements are only created for the channels the mesh has
+  static const char *uvNames[UVSetCount] = {"DiffuseUV", "SizeXY", "CenterXY", "CenterZDimming", "PivotXY"};
+  FbxLayerElementUV *uvLayers[UVSetCount];
+  for (int uv = 0; uv < UVSetCount; ++uv)
   {
-    int pos = 1;
-    while (pos)
+    uvLayers[uv] = m.Attributes & UVAttribute(uv) ? FbxLayerElementUV::Create(o.Mesh, uvNames[uv]) : NULL;
+  }
+  // Baked wind: weight and matrix index of a wind level per UV set
+  static const char *windNames[2] = {"WindLevel0", "WindLevel1"};
+  FbxLayerElementUV *windLayers[2];
+  for (int level = 0; level < 2; ++level)
+  {
+    windLayers[level] = m.Attributes & AttrWind ? FbxLayerElementUV::Create(o.Mesh, windNames[level]) : NULL;
+  }
+  FbxLayerElementNormal *layerElementNormal = m.Attributes & AttrNormals ? FbxLayerElementNormal::Create(o.Mesh, "") : NULL;
+  FbxLayerElementBinormal *layerElementBinormal = m.Attributes & AttrBinormals ? FbxLayerElementBinormal::Create(o.Mesh, "") : NULL;
+  FbxLayerElementTangent *layerElementTangent = m.Attributes & AttrTangents ? FbxLayerElementTangent::Create(o.Mesh, "") : NULL;
+  FbxLayerElementVertexColor *layerElementColor = m.Attributes & AttrColors ? FbxLayerElementVertexColor::Create(o.Mesh, "") : NULL;
+  FbxLayerElement *elements[] = {uvLayers[0], uvLayers[1], uvLayers[2], uvLayers[3], uvLayers[4], windLayers[0], windLayers[1], layerElementNormal, layerElementBinormal, layerElementTangent, layerElementColor};
+  for (size_t i = 0; i < sizeof(elements) / sizeof(elements[0]); ++i)
+  {
+    if (elements[i])
     {
-      const char mType = uData[pos]; pos++;
-      if (!mType || (mType != 'b' && mType != 'f' && mType != 'l'))
-      {
-        break;
-      }
-      int length = uData[pos]; pos++;
-      char *name = (char *)malloc(length + 1);
-      memcpy(name, &uData[pos], length);
-      name[length] = '\0'; pos += length;
-      switch (mType)
-      {
-        case 'b':
-        {
-          std::string finalName = std::string(name) + "_branches";
-          FbxSurfaceMaterial *m = FbxSurfaceLambert::Create(o.Scene, finalName.c_str());
-          branchMatIdx = o.MeshNode->AddMaterial(m);
-          break;
-        }
-        case 'f':
-        {
-          std::string finalName = std::string(name) + "_fronds";
-          FbxSurfaceMaterial *m = FbxSurfaceLambert::Create(o.Scene, finalName.c_str());
-          frondMatIdx = o.MeshNode->AddMaterial(m);
-          break;
-        }
-        case 'l':
-        {
-          std::string finalName = std::string(name) + "_leafs";
-          FbxSurfaceMaterial *m = FbxSurfaceLambert::Create(o.Scene, finalName.c_str());
-          leafMatIdx = o.MeshNode->AddMaterial(m);
-          break;
-        }
-        default:
-          break;
-      }
-      free(name);
+      elements[i]->SetMappingMode(FbxLayerElement::eByControlPoint);
+      elements[i]->SetReferenceMode(FbxLayerElement::eDirect);
     }
   }
 
-  FbxLayerElementUV *uvDiffuseLayer = FbxLayerElementUV::Create(o.Mesh, "DiffuseUV");
-  FbxLayerElementUV *uvCustom1 = FbxLayerElementUV::Create(o.Mesh, "SizeXY");
-  FbxLayerElementUV *uvCustom2 = FbxLayerElementUV::Create(o.Mesh, "CenterXY");
-  FbxLayerElementUV *uvCustom3 = FbxLayerElementUV::Create(o.Mesh, "CenterZDimming");
-  FbxLayerElementUV *uvCustom4 = FbxLayerElementUV::Create(o.Mesh, "PivotXY");
-  FbxLayerElementNormal *layerElementNormal = FbxLayerElementNormal::Create(o.Mesh, "");
-  FbxLayerElementBinormal *layerElementBinormal = FbxLayerElementBinormal::Create(o.Mesh, "");
-  FbxLayerElementTangent *layerElementTangent = FbxLayerElementTangent::Create(o.Mesh, "");
-  FbxLayerElementVertexColor *layerElementColor = FbxLayerElementVertexColor::Create(o.Mesh, "");
-  uvDiffuseLayer->SetMappingMode(FbxLayerElement::eByControlPoint);
-  uvDiffuseLayer->SetReferenceMode(FbxLayerElement::eDirect);
-  uvCustom1->SetMappingMode(FbxLayerElement::eByControlPoint);
-  uvCustom1->SetReferenceMode(FbxLayerElement::eDirect);
-  uvCustom2->SetMappingMode(FbxLayerElement::eByControlPoint);
-  uvCustom2->SetReferenceMode(FbxLayerElement::eDirect);
-  uvCustom3->SetMappingMode(FbxLayerElement::eByControlPoint);
-  uvCustom3->SetReferenceMode(FbxLayerElement::eDirect);
-  uvCustom4->SetMappingMode(FbxLayerElement::eByControlPoint);
-  uvCustom4->SetReferenceMode(FbxLayerElement::eDirect);
-  layerElementNormal->SetMappingMode(FbxLayerElement::eByControlPoint);
-  layerElementNormal->SetReferenceMode(FbxLayerElement::eDirect);
-  layerElementBinormal->SetMappingMode(FbxLayerElement::eByControlPoint);
-  layerElementBinormal->SetReferenceMode(FbxLayerElement::eDirect);
-  layerElementTangent->SetMappingMode(FbxLayerElement::eByControlPoint);
-  layerElementTangent->SetReferenceMode(FbxLayerElement::eDirect);
-  layerElementColor->SetMappingMode(FbxLayerElement::eByControlPoint);
-  layerElementColor->SetReferenceMode(FbxLayerElement::eDirect);
-
-  // Building branches
-
-
-  if (geometry.m_sBranches.m_nNumLods > o.Lod && geometry.m_sBranches.m_pNumStrips)
-  {
-    CSpeedTreeRT::SGeometry::SIndexed const *s = &geometry.m_sBranches;
-    for (int i = 0; i < uniqueBranchIndices.size(); ++i)
+  for (int i = 0; i < vertexCount; ++i)
+  {
+    const double *pos = &m.Positions[i * 3];
+    controlPoints[i] = FbxVector4(pos[0], pos[1], pos[2]);
+    if (layerElementNormal)
+    {
+      const float *normal = &m.Normals[i * 3];
+      layerElementNormal->GetDirectArray().Add(FbxVector4(normal[0], normal[1], normal[2]));
+    }
+    if (layerElementBinormal)
+    {
+      const float *binorm = &m.Binormals[i * 3];
+      layerElementBinormal->GetDirectArray().Add(FbxVector4(binorm[0], binorm[1], binorm[2]));
+    }
+    if (layerElementTangent)
+    {
+      const float *tangent = &m.Tangents[i * 3];
+      layerElementTangent->GetDirectArray().Add(FbxVector4(tangent[0], tangent[1], tangent[2]));
+    }
+    if (layerElementColor)
     {
-      int idx = uniqueBranchIndices[i];
-      const float *pos = &s->m_pCoords[idx * 3];
-      const float *normal = &s->m_pNormals[idx * 3];
-      const float *binorm = &s->m_pBinormals[idx * 3];
-      const float *tangent = &s->m_pTangents[idx * 3];
-      const float *uvs = &s->m_pTexCoords[CSpeedTreeRT::TL_DIFFUSE][idx * 2];
-      controlPoints[offset + i] = CPos(pos[0], pos[1], pos[2]);
-      layerElementNormal->GetDirectArray().Add(CNorm(normal[0], normal[1], normal[2]));
-      layerElementBinormal->GetDirectArray().Add(CBiNorm(binorm[0], binorm[1], binorm[2]));
-      layerElementTangent->GetDirectArray().Add(CTang(tangent[0], tangent[1], tangent[2]));
-      uvDiffuseLayer->GetDirectArray().Add(FbxVector2(uvs[0], uvs[1]));
-      uvCustom1->GetDirectArray().Add(FbxVector2(0, 0));
-      uvCustom2->GetDirectArray().Add(FbxVector2(0, 0));
-      uvCustom3->GetDirectArray().Add(FbxVector2(0, 0));
-      uvCustom4->GetDirectArray().Add(FbxVector2(0, 0));
-      if (s->m_pColors)
+      const unsigned char *color = &m.Colors[i * 4];
+      layerElementColor->GetDirectArray().Add(FbxColor((float)color[0] / 255., (float)color[1] / 255., (float)color[2] / 255., (float)color[3] / 255.));
+    }
+    for (int uv = 0; uv < UVSetCount; ++uv)
+    {
+      if (uvLayers[uv])
       {
-        unsigned char *colors = (unsigned char *)&s->m_pColors[idx];
-        layerElementColor->GetDirectArray().Add(FbxColor((float)colors[0] / 255., (float)colors[1] / 255., (float)colors[2] / 255., (float)colors[3] / 255.));
+        uvLayers[uv]->GetDirectArray().Add(FbxVector2(m.UVs[uv][i * 2], m.UVs[uv][i * 2 + 1]));
       }
-      else
+    }
+    for (int level = 0; level < 2; ++level)
+    {
+      if (windLayers[level])
       {
-        layerElementColor->GetDirectArray().Add(FbxColor(0,0,0));
+        windLayers[level]->GetDirectArray().Add(FbxVector2(m.Wind[i * 4 + level * 2], m.Wind[i * 4 + level * 2 + 1]));
       }
     }
+  }
+
+  const int triangleCount = m.GetTriangleCount();
+  for (int i = 0; i < triangleCount; ++i)
+  {
+    o.Mesh->BeginPolygon(m.Materials[i], -1, m.Groups[i]);
+    o.Mesh->AddPolygon(m.Indices[i * 3]);
+    o.Mesh->AddPolygon(m.Indices[i * 3 + 1]);
+    o.Mesh->AddPolygon(m.Indices[i * 3 + 2]);
+    o.Mesh->EndPolygon();
+  }
 
-    if (branchMatIdx == -1)
+  if (layerElementNormal)
+  {
+    layer->SetNormals(layerElementNormal);
+  }
+  if (layerElementBinormal)
+  {
+    layer->SetBinormals(layerElementBinormal);
+  }
+  if (layerElementTangent)
+  {
+    layer->SetTangents(layerElementTangent);
+  }
+  if (layerElementColor)
+  {
+    layer->SetVertexColors(layerElementColor);
+  }
+  const FbxLayerElement::EType uvTypes[UVSetCount] = {
+    FbxLayerElement::eTextureDiffuse,
+    FbxLayerElement::eTextureEmissive,  // cardWidth, cardHeight
+    FbxLayerElement::eTextureAmbient,   // leafPositionX, leafPositionY
+    FbxLayerElement::eTextureSpecular,  // leafPositionZ, leafDimming
+    FbxLayerElement::eTextureNormalMap, // cardPivotU, cardPivotV
+  };
+  for (int uv = 0; uv < UVSetCount; ++uv)
+  {
+    if (uvLayers[uv])
     {
-      FbxSurfaceMaterial *m = FbxSurfaceLambert::Create(o.Scene, "BranchMAT");
-      branchMatIdx = o.MeshNode->AddMaterial(m);
+      layer->SetUVs(uvLayers[uv], uvTypes[uv]);
     }
-
-    for(int strip = 0; strip < s->m_pNumStrips[o.Lod]; ++strip)
+  }
+  const FbxLayerElement::EType windTypes[2] = {
+    FbxLayerElement::eTextureBump,         // windWeight0, windMatrix0
+    FbxLayerElement::eTextureTransparency, // windWeight1, windMatrix1
+  };
+  for (int level = 0; level < 2; ++level)
+  {
+    if (windLayers[level])
     {
-      const int length = s->m_pStripLengths[o.Lod][strip];
-      const int *indices = s->m_pStrips[o.Lod][strip];
-
-      for(int i = 0; i < length - 3; ++i)
-      {
-        int polygon[3] = {indices[i], indices[i+1], indices[i+2]};
-        if (i % 2 == 0)
-        {
-          std::swap(polygon[0], polygon[1]);
-        }
-
-        o.Mesh->BeginPolygon(branchMatIdx, -1, group);
-        for (int j = 0; j < 3; ++j)
-        {
-          o.Mesh->AddPolygon(offset + std::distance(uniqueBranchIndices.begin(), std::find(uniqueBranchIndices.begin(), uniqueBranchIndices.end(), polygon[j])));
-        }
-        o.Mesh->EndPolygon();
-      }
+      layer->SetUVs(windLayers[level], windTypes[level]);
     }
-    offset += uniqueBranchIndices.size();
-    group++;
   }
+  
+  return true;
+}
 
-  // Building fronds
+struct FormatInfo
+{
+  const char *Name;
+  const char *Extension;
+  const char *WriterDescription;
+};
+
+static const FormatInfo Formats[] = {
+  { "fbx", "fbx", NULL }, // Writer 0 is the native FBX binary writer
+  { "fbx-ascii", "fbx", "FBX ascii" },
+  { "fbx6", "fbx", "FBX 6.0 binary" },
+  { "obj", "obj", "(*.obj)" },
+  { "dae", "dae", "(*.dae)" },
+  { "dxf", "dxf", "(*.dxf)" },
+};
 
-  if (geometry.m_sFronds.m_nNumLods > o.Lod && geometry.m_sFronds.m_pNumStrips)
+static const FormatInfo *FindFormat(std::string const &format)
+{
+  for (size_t i = 0; i < sizeof(Formats) / sizeof(Formats[0]); ++i)
   {
-    CSpeedTreeRT::SGeometry::SIndexed const *s = &geometry.m_sFronds;
-    for (int i = 0; i < uniqueFrondIndices.size(); ++i)
+    if (format == Formats[i].Name)
     {
-      int idx = uniqueFrondIndices[i];
-      const float *pos = &s->m_pCoords[idx * 3];
-      const float *normal = &s->m_pNormals[idx * 3];
-      const float *binorm = &s->m_pBinormals[idx * 3];
-      const float *tangent = &s->m_pTangents[idx * 3];
-      const float *uvs = &s->m_pTexCoords[CSpeedTreeRT::TL_DIFFUSE][idx * 2];
-      controlPoints[offset + i] = CPos(pos[0], pos[1], pos[2]);
-      layerElementNormal->GetDirectArray().Add(CNorm(normal[0], normal[1], normal[2]));
-      layerElementBinormal->GetDirectArray().Add(CBiNorm(binorm[0], binorm[1], binorm[2]));
-      layerElementTangent->GetDirectArray().Add(CTang(tangent[0], tangent[1], tangent[2]));
-      uvDiffuseLayer->GetDirectArray().Add(FbxVector2(uvs[0], uvs[1]));
-      uvCustom1->GetDirectArray().Add(FbxVector2(0, 0));
-      uvCustom2->GetDirectArray().Add(FbxVector2(0, 0));
-      uvCustom3->GetDirectArray().Add(FbxVector2(0, 0));
-      uvCustom4->GetDirectArray().Add(FbxVector2(0, 0));
-      if (s->m_pColors)
-      {
-        unsigned char *colors = (unsigned char *)&s->m_pColors[idx];
-        layerElementColor->GetDirectArray().Add(FbxColor((float)colors[0] / 255., (float)colors[1] / 255., (float)colors[2] / 255., (float)colors[3] / 255.));
-      }
-      else
-      {
-        layerElementColor->GetDirectArray().Add(FbxColor(0,0,0));
-      }
+      return &Formats[i];
     }
+  }
+  return NULL;
+}
 
-    if (frondMatIdx == -1)
-    {
-      FbxSurfaceMaterial *m = FbxSurfaceLambert::Create(o.Scene, "FrondMAT");
-      frondMatIdx = o.MeshNode->AddMaterial(m);
-    }
+const char *FormatExtension(std::string const &format)
+{
+  const FormatInfo *info = FindFormat(format);
+  return info ? info->Extension : NULL;
+}
 
-    for(int strip = 0; strip < s->m_pNumStrips[o.Lod]; ++strip)
-    {
-      const int length = s->m_pStripLengths[o.Lod][strip];
-      const int *indices = s->m_pStrips[o.Lod][strip];
+// SpeedTreeRT is not documented as thread-safe, so loading and computing trees
+// is serialized. Geometry generation and saving run concurrently.
+static Mutex SpeedTreeLock;
 
-      for(int i = 0; i < length - 2; ++i)
-      {
-        int polygon[3] = {indices[i], indices[i+1], indices[i+2]};
-        if (i % 2 == 0)
-        {
-          std::swap(polygon[0], polygon[1]);
-        }
-        o.Mesh->BeginPolygon(frondMatIdx, -1, group);
-        for (int j = 0; j < 3; ++j)
-        {
-          o.Mesh->AddPolygon(offset + std::distance(uniqueFrondIndices.begin(), std::find(uniqueFrondIndices.begin(), uniqueFrondIndices.end(), polygon[j])));
-        }
-        o.Mesh->EndPolygon();
-      }
-    }
-    offset += uniqueFrondIndices.size();
-    group++;
+static bool SaveGeometryCache(std::wstring const &path, TreeGeometry const &geometry, ExportResult &result)
+{
+  FILE *f = NULL;
+  if (_wfopen_s(&f, path.c_str(), L"wb"))
+  {
+    result.Error = "Failed to save: " + w2a(path);
+    return false;
   }
+  bool ok = WriteGeometryCache(f, geometry);
+  ok = fclose(f) == 0 && ok;
+  if (!ok)
+  {
+    result.Error = "Failed to save: " + w2a(path);
+  }
+  return ok;
+}
 
-  // Building leaf cards
+// Re-exports a tree from a geometry cache, SpeedTreeRT is never touched
+static bool ProcessCache(std::wstring const &cachePath, ExportOptions const &options, ExportResult &result, FbxManager *manager)
+{
+  const double start = GetTimeMs();
+  GeometryCache cache;
+  std::string error;
+  if (!cache.Open(cachePath, error))
+  {
+    result.Error = error + ": " + w2a(cachePath);
+    return false;
+  }
+  result.LoadMs = GetTimeMs() - start;
+  bool ok = ExportTree(cache.GetGeometry(), cachePath, options, result, manager);
+  result.TotalMs = GetTimeMs() - start;
+  return ok;
+}
 
-  if (tree->GetNumLeafLodLevels() > o.Lod)
+bool ProcessTree(std::wstring const &sptFilePath, ExportOptions const &options, ExportResult &result, FbxManager *manager)
+{
+  if (IsGeometryCachePath(sptFilePath))
   {
-    bool secondaryIndexForMesh = false;
-    CSpeedTreeRT::SGeometry::SLeaf *s = &geometry.m_pLeaves[o.Lod];
-    int leafCount = s->m_nNumLeaves;
+    return ProcessCache(sptFilePath, options, result, manager);
+  }
 
-    if (leafCount && leafMatIdx == -1)
-    {
-      FbxSurfaceMaterial *m = FbxSurfaceLambert::Create(o.Scene, "LeafMAT");
-      leafMatIdx = o.MeshNode->AddMaterial(m);
-    }
-    int processedLeafs = 0;
-    for (int leaf = 0; leaf < leafCount; ++leaf)
+  const double start = GetTimeMs();
+  FILE *f = NULL;
+  if (_wfopen_s(&f, sptFilePath.c_str(), L"rb"))
+  {
+    result.Error = "Failed to open: " + w2a(sptFilePath);
+    return false;
+  }
+  fseek(f, 0, SEEK_END);
+  long size = ftell(f);
+  if (!size)
+  {
+    result.Error = "File corrupted: " + w2a(sptFilePath);
+    fclose(f);
+    return false;
+  }
+  rewind(f);
+  unsigned char *buf = static_cast<unsigned char*>(malloc(size));
+  fread(buf, sizeof(unsigned char), size, f);
+  fclose(f);
+
+  CSpeedTreeRT *tree = new CSpeedTreeRT;
+  CSpeedTreeRT::SGeometry sg;
+  TreeGeometry geometry;
+  {
+    ScopedLock lock(SpeedTreeLock);
+    if (!tree->LoadTree(buf, static_cast<unsigned int>(size)))
     {
-      const CSpeedTreeRT::SGeometry::SLeaf::SCard *card = &s->m_pCards[s->m_pLeafCardIndices[leaf]];
-      const float *center = &s->m_pCenterCoords[leaf * 3];
-      float pivot[2];
-      pivot[0] = (card->m_pTexCoords[0 * 2] + card->m_pTexCoords[2 * 2]) / 2.;
-      pivot[1] = (card->m_pTexCoords[0 * 2 + 1] + card->m_pTexCoords[2 * 2 + 1]) / 2.;
-      if (!card->m_pMesh)
-      {
-        int cornerIndicies[] = {0,0,0,0};
-        for (int corner = 0; corner < 4; ++corner)
-        {
-          const float *pos = &card->m_pCoords[corner * 4];
-          const float *normal = &s->m_pNormals[12 * leaf + (corner * 3)];
-          const float *binorm = &s->m_pBinormals[12 * leaf + (corner * 3)];
-          const float *tangent = &s->m_pTangents[12 * leaf + (corner * 3)];
-          const float *uvs = &card->m_pTexCoords[corner * 2];
-          controlPoints[offset + (processedLeafs * 4 + corner)] = CPos(pos[0] + center[0], pos[1] + center[1], pos[2] + center[2]);
-          layerElementNormal->GetDirectArray().Add(CNorm(normal[0], normal[1], normal[2]));
-          layerElementBinormal->GetDirectArray().Add(CBiNorm(binorm[0], binorm[1], binorm[2]));
-          layerElementTangent->GetDirectArray().Add(CTang(tangent[0], tangent[1], tangent[2]));
-          uvDiffuseLayer->GetDirectArray().Add(FbxVector2(uvs[0], uvs[1]));
-          uvCustom1->GetDirectArray().Add(FbxVector2(card->m_fWidth, card->m_fHeight));
-          uvCustom2->GetDirectArray().Add(FbxVector2(center[0], -center[1]));
-          uvCustom3->GetDirectArray().Add(FbxVector2(center[2], s->m_pDimming[leaf]));
-          uvCustom4->GetDirectArray().Add(FbxVector2(pivot[0], pivot[1]));
-
-          if (s->m_pColors)
-          {
-            unsigned char *colors = (unsigned char *)&s->m_pColors[leaf * 4 + corner];
-            layerElementColor->GetDirectArray().Add(FbxColor((float)colors[0] / 255., (float)colors[1] / 255., (float)colors[2] / 255., (float)colors[3] / 255.));
-          }
-          else
-          {
-            layerElementColor->GetDirectArray().Add(FbxColor(0,0,0));
-          }
-
-          cornerIndicies[corner] = offset + (processedLeafs * 4 + corner);
-        }
-
-        o.Mesh->BeginPolygon(leafMatIdx, -1, group);
-        o.Mesh->AddPolygon(cornerIndicies[0]);
-        o.Mesh->AddPolygon(cornerIndicies[1]);
-        o.Mesh->AddPolygon(cornerIndicies[2]);
-        o.Mesh->EndPolygon();
-        o.Mesh->BeginPolygon(leafMatIdx, -1, group);
-        o.Mesh->AddPolygon(cornerIndicies[0]);
-        o.Mesh->AddPolygon(cornerIndicies[2]);
-        o.Mesh->AddPolygon(cornerIndicies[3]);
-        o.Mesh->EndPolygon();
-        processedLeafs++;
-      }
+      result.Error = "Couldn't load the tree: " + w2a(sptFilePath);
+      free(buf);
+      delete tree;
+      return false;
     }
-    group++;
-    offset += processedLeafs * 4;
+    result.LoadMs = GetTimeMs() - start;
+
+    // make sure SpeedTreeRT generates normals. This stays on for skipped sections too:
+    // Compute builds every section anyway and static lighting would only add work.
+    tree->SetBranchLightingMethod(CSpeedTreeRT::LIGHT_DYNAMIC);
+    tree->SetLeafLightingMethod(CSpeedTreeRT::LIGHT_DYNAMIC);
+    tree->SetFrondLightingMethod(CSpeedTreeRT::LIGHT_DYNAMIC);
+
+    const double t = GetTimeMs();
+    tree->Compute(0, tree->GetSeed());
+    // A cache holds the whole tree, otherwise only the exported sections and LOD are fetched
+    GetTreeGeometry(tree, options.Cache ? AllSections : options.Sections, options.Cache ? -1 : options.Lod, sg, geometry);
+    result.ComputeMs = GetTimeMs() - t;
   }
 
-  // Building leaf meshes
-  if (tree->GetNumLeafLodLevels() > o.Lod)
+  bool ok = true;
+  if (options.Cache)
   {
-    int leafMatIdx2 = -1;
-    CSpeedTreeRT::SGeometry::SLeaf *s = &geometry.m_pLeaves[o.Lod];
-    int leafCount = s->m_nNumLeaves;
+    std::wstring const &base = options.Destination.empty() ? sptFilePath : options.Destination;
+    ok = SaveGeometryCache(base.substr(0, base.find_last_of('.')) + L".sptc", geometry, result);
+  }
+  ok = ok && ExportTree(geometry, sptFilePath, options, result, manager);
 
-    if (leafCount && leafMatIdx == -1)
-    {
-      FbxSurfaceMaterial *m = FbxSurfaceLambert::Create(o.Scene, "LeafMAT");
-      leafMatIdx = o.MeshNode->AddMaterial(m);
-    }
+  free(buf);
+  delete tree;
+  result.TotalMs = GetTimeMs() - start;
+  return ok;
+}
 
-    for (int leaf = 0; leaf < leafCount; ++leaf)
-    {
-      const CSpeedTreeRT::SGeometry::SLeaf::SCard *card = &s->m_pCards[s->m_pLeafCardIndices[leaf]];
-      const float *center = &s->m_pCenterCoords[leaf * 3];
-      const float *pivot = card->m_afPivotPoint;
-      if (card->m_pMesh)
-      {
-        if (leafMatIdx2 == -1)
-        {
-          const char *leafMatName = o.MeshNode->GetMaterial(leafMatIdx)->GetName();
-          std::string newMatName("LeafMeshMAT");
-          if (leafMatName && leafMatName != "LeafMAT")
-          {
-            newMatName = std::string(leafMatName) + "mesh";
-          }
-          FbxSurfaceMaterial *m = FbxSurfaceLambert::Create(o.Scene, newMatName.c_str());
-          leafMatIdx2 = o.MeshNode->AddMaterial(m);
-        }
-        else if (leafMatIdx2 == -1)
-        {
-          leafMatIdx2 = leafMatIdx;
-        }
-        const CSpeedTreeRT::SGeometry::SLeaf::SMesh *mesh = card->m_pMesh;
-        for (int vert = 0; vert < mesh->m_nNumVertices; ++vert)
-        {
-          const float *pos = &mesh->m_pCoords[vert * 3];
-          const float *normal = &mesh->m_pNormals[vert * 3];
-          const float *binorm = &mesh->m_pBinormals[vert * 3];
-          const float *tangent = &mesh->m_pTangents[vert * 3];
-          const float *uvs = &mesh->m_pTexCoords[vert * 2];
-          controlPoints[offset + vert] = CPos(pos[0] + center[0], pos[1] + center[1], pos[2] + center[2]);
-          layerElementNormal->GetDirectArray().Add(CNorm(normal[0], normal[1], normal[2]));
-          layerElementBinormal->GetDirectArray().Add(CBiNorm(binorm[0], binorm[1], binorm[2]));
-          layerElementTangent->GetDirectArray().Add(CTang(tangent[0], tangent[1], tangent[2]));
-          layerElementColor->GetDirectArray().Add(FbxColor(0,0,0));
-          uvDiffuseLayer->GetDirectArray().Add(FbxVector2(uvs[0], uvs[1]));
-          uvCustom1->GetDirectArray().Add(FbxVector2(card->m_fWidth, card->m_fHeight));
-          uvCustom2->GetDirectArray().Add(FbxVector2(center[0], center[1]));
-          uvCustom3->GetDirectArray().Add(FbxVector2(center[2], s->m_pDimming[leaf]));
-          uvCustom4->GetDirectArray().Add(FbxVector2(pivot[0], pivot[1]));
-        }
-        for (int i = 0; i < mesh->m_nNumIndices - 2; i+=3)
-        {
-          int polygon[3] = {mesh->m_pIndices[i+1], mesh->m_pIndices[i], mesh->m_pIndices[i+2]};
-          o.Mesh->BeginPolygon(leafMatIdx2, -1, group);
-          for (int j = 0; j < 3; ++j)
-          {
-            o.Mesh->AddPolygon(offset + polygon[j]);
-          }
-          o.Mesh->EndPolygon();
-        }
-        offset += mesh->m_nNumVertices;
-      }
-    }
-    group++;
-  }
-
-  layer->SetNormals(layerElementNormal);
-  layer->SetBinormals(layerElementBinormal);
-  layer->SetTangents(layerElementTangent);
-  layer->SetVertexColors(layerElementColor);
-  layer->SetUVs(uvDiffuseLayer, FbxLayerElement::eTextureDiffuse);
-  layer->SetUVs(uvCustom1, FbxLayerElement::eTextureEmissive); // cardWidth, cardHeight
-  layer->SetUVs(uvCustom2, FbxLayerElement::eTextureAmbient); // leafPositionX, leafPositionY
-  layer->SetUVs(uvCustom3, FbxLayerElement::eTextureSpecular); // leafPositionZ, leafDimming
-  layer->SetUVs(uvCustom4, FbxLayerElement::eTextureNormalMap); // cardPivotU, cardPivotV
-  
-  return true;
+static bool SaveMeshlets(std::wstring const &path, MeshletSet const &meshlets, MeshletOptions const &options, ExportResult &result)
+{
+  FILE *f = NULL;
+  if (_wfopen_s(&f, path.c_str(), L"wb"))
+  {
+    result.Error = "Failed to save: " + w2a(path);
+    return false;
+  }
+  bool ok = WriteMeshlets(f, meshlets, options);
+  ok = fclose(f) == 0 && ok;
+  if (!ok)
+  {
+    result.Error = "Failed to save: " + w2a(path);
+  }
+  return ok;
 }
 
-void ExportTree(CSpeedTreeRT *tree, std::wstring const&path)
+static std::string JoinProblems(std::vector<std::string> const &problems)
+{
+  std::string result;
+  for (size_t i = 0; i < problems.size(); ++i)
+  {
+    result += (i ? "; " : "") + problems[i];
+  }
+  return result;
+}
+
+bool ExportTree(TreeGeometry const &geometry, std::wstring const &path, ExportOptions const &options, ExportResult &result, FbxManager *manager)
 {
   std::wstring name;
 	if (path.find_last_of('\\') == std::wstring::npos)
@@ -514,33 +468,179 @@ void ExportTree(CSpeedTreeRT *tree, std::wstring const&path)
 		name = path.substr(pos, path.find_last_of('.') - pos);
 	}
 
-  std::wstring destination(path.substr(0, path.find_last_of('.')) + L".fbx");
-  std::wcout << "Exporting " << name << "... ";
+  const FormatInfo *format = FindFormat(options.Format);
+  if (!format)
+  {
+    result.Error = "Unknown format: " + options.Format;
+    return false;
+  }
+
+  std::wstring destination(options.Destination);
+  if (destination.empty())
+  {
+    destination = path.substr(0, path.find_last_of('.')) + L"." + a2w(format->Extension);
+  }
+  result.Destination = destination;
 
   TreeStorage o;
-  InitializeSdkObjects(o.SdkManager, o.Scene);
-  FbxDocumentInfo* sceneInfo = FbxDocumentInfo::Create(o.SdkManager, "SceneInfo");
+  const bool ownsManager = manager == NULL;
+  o.SdkManager = ownsManager ? CreateSdkManager() : manager;
+  o.Scene = o.SdkManager ? CreateScene(o.SdkManager) : NULL;
+  if (!o.Scene)
+  {
+    result.Error = "Failed to initialize FBX SDK";
+    if (ownsManager)
+    {
+      DestroySdkObjects(o.SdkManager);
+    }
+    return false;
+  }
+  int fileFormat = 0;
+  if (format->WriterDescription)
+  {
+    fileFormat = FindWriterFormat(o.SdkManager, format->WriterDescription);
+  }
+
+  FbxDocumentInfo* sceneInfo = FbxDocumentInfo::Create(o.Scene, "SceneInfo");
   sceneInfo->mTitle = w2a(name).c_str();
   o.Scene->SetSceneInfo(sceneInfo);
   o.Mesh = FbxMesh::Create(o.Scene, "geometry");
   o.MeshNode = FbxNode::Create(o.Scene, w2a(name).c_str());
-  o.MeshNode->SetNodeAttribute(o.Mesh);
   o.Scene->GetRootNode()->AddChild(o.MeshNode);
 
-  if (!GenerateTree(tree, o))
+  double t = GetTimeMs();
+  TreeMesh mesh;
+  ExtractOptions extract;
+  extract.Lod = options.Lod;
+  extract.Attributes = options.Attributes;
+  extract.Threads = options.Threads > 0 ? options.Threads : GetProcessorCount();
+  extract.Sections = options.Sections;
+  bool ok = ExtractTree(geometry, extract, mesh);
+  if (ok && options.Weld)
   {
-    std::cout << "Failed to export: " << w2a(name) << std::endl;
-    DestroySdkObjects(o.SdkManager);
-    return;
+    result.WeldedVertices = WeldVertices(mesh, options.WeldEpsilon);
+  }
+  // Invalid geometry must fail a tree under a failing budget even without --validate
+  std::vector<std::string> problems;
+  if (ok && (options.Validate || options.Budget.Fail))
+  {
+    ValidateMesh(mesh, result.Stats);
+    DescribeProblems(result.Stats, problems);
   }
+  for (size_t i = 0; ok && i < mesh.MaterialNames.size(); ++i)
+  {
+    o.Materials.push_back(FbxSurfaceLambert::Create(o.Scene, mesh.MaterialNames[i].c_str()));
+  }
+  result.Materials = (int)mesh.MaterialNames.size();
 
-  if (!SaveScene(o.SdkManager, o.Scene, w2a(destination).c_str(), 0))
+  MeshletSet meshlets;
+  const std::wstring meshletsPath = destination.substr(0, destination.find_last_of('.')) + L".meshlets";
+  if (ok && !options.Partition.Leaves && !options.Partition.Fronds)
   {
-    std::cout << "Failed to save: " << w2a(destination) << std::endl;
+    o.MeshNode->SetNodeAttribute(o.Mesh);
+    ok = GenerateTree(mesh, NULL, o);
+    if (ok && options.Meshlets)
+    {
+      BuildMeshlets(mesh, 0, options.MeshletLimits, meshlets);
+    }
+    result.Vertices = mesh.GetVertexCount();
+    result.Triangles = mesh.GetTriangleCount();
+    result.Nodes = 1;
+  }
+  else if (ok)
+  {
+    // Clusters become children of the tree node, the main part keeps everything else
+    std::vector<MeshPart> parts;
+    PartitionMesh(mesh, options.Partition, parts);
+    for (size_t i = 0; ok && i < parts.size(); ++i)
+    {
+      MeshPart const &part = parts[i];
+      if (!i && !part.Mesh.GetTriangleCount() && parts.size() > 1)
+      {
+        // The tree node stays as the parent of the clusters and keeps part number 0
+        o.Mesh->Destroy();
+        result.Nodes++;
+        continue;
+      }
+      TreeStorage p = o;
+      if (i)
+      {
+        p.MeshNode = FbxNode::Create(o.Scene, (w2a(name) + part.Suffix).c_str());
+        p.Mesh = FbxMesh::Create(o.Scene, ("geometry" + part.Suffix).c_str());
+        o.MeshNode->AddChild(p.MeshNode);
+        // Pivot at the center of the cluster's bounds, vertices stay in tree space
+        FbxVector4 center((part.BoundsMin[0] + part.BoundsMax[0]) * .5, (part.BoundsMin[1] + part.BoundsMax[1]) * .5, (part.BoundsMin[2] + part.BoundsMax[2]) * .5);
+        p.MeshNode->SetRotationPivot(FbxNode::eSourcePivot, center);
+        p.MeshNode->SetScalingPivot(FbxNode::eSourcePivot, center);
+      }
+      p.MeshNode->SetNodeAttribute(p.Mesh);
+      ok = GenerateTree(part.Mesh, &part.MaterialIds, p);
+      if (ok && options.Meshlets)
+      {
+        BuildMeshlets(part.Mesh, (unsigned int)result.Nodes, options.MeshletLimits, meshlets);
+      }
+      result.Vertices += part.Mesh.GetVertexCount();
+      result.Triangles += part.Mesh.GetTriangleCount();
+      result.Nodes++;
+    }
+  }
+  result.Meshlets = (int)meshlets.Meshlets.size();
+  result.GenerateMs = GetTimeMs() - t;
+  CheckBudget(options.Budget, result.Vertices, result.Triangles, 0, problems);
+  if (!ok)
+  {
+    result.Error = "Failed to export: " + w2a(name);
+  }
+  else if (options.Budget.Fail && !problems.empty())
+  {
+    ok = false;
+    result.Error = JoinProblems(problems);
+  }
+  else if (fileFormat < 0)
+  {
+    ok = false;
+    result.Error = "No FBX SDK writer for format: " + options.Format;
   }
   else
   {
-    std::wcout << "Done." << std::endl;
+    t = GetTimeMs();
+    ok = SaveScene(o.SdkManager, o.Scene, w2a(destination).c_str(), fileFormat);
+    if (!ok)
+    {
+      result.Error = "Failed to save: " + w2a(destination);
+    }
+    else if (options.Meshlets)
+    {
+      ok = SaveMeshlets(meshletsPath, meshlets, options.MeshletLimits, result);
+    }
+    result.SaveMs = GetTimeMs() - t;
+    result.OutputBytes = ok ? FileSize(destination) : 0;
+    CheckBudget(options.Budget, 0, 0, result.OutputBytes, problems);
+    if (ok && options.Budget.Fail && !problems.empty())
+    {
+      // A failed tree leaves no output behind
+      ok = false;
+      result.Error = JoinProblems(problems);
+      _wremove(destination.c_str());
+      if (options.Meshlets)
+      {
+        _wremove(meshletsPath.c_str());
+      }
+    }
   }
-  DestroySdkObjects(o.SdkManager);
-}
\ No newline at end of file
+  if (ok)
+  {
+    result.Warnings = problems;
+  }
+
+  if (ownsManager)
+  {
+    DestroySdkObjects(o.SdkManager);
+  }
+  else
+  {
+    o.Scene->Destroy();
+  }
+  result.Success = ok;
+  return ok;
+}
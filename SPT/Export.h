@@ -1,4 +1,92 @@
-#include <SpeedTreeRT.h>
+#ifndef _EXPORT_H
+#define _EXPORT_H
+
+#include "Meshlets.h"
+#include "Partition.h"
+#include "TreeGeometry.h"
+#include "Validation.h"
+#include "Weld.h"
+
+#include <fbxsdk.h>
 #include <string>
+#include <vector>
+
+struct ExportOptions
+{
+  ExportOptions()
+  {
+    Format = "fbx";
+    Lod = 0;
+    Meshlets = false;
+    Cache = false;
+    Attributes = AttrAll;
+    Threads = 0;
+    Sections = AllSections;
+    Validate = false;
+    Weld = false;
+    WeldEpsilon = 0.;
+  }
+  std::wstring Destination; // Empty: next to the source with the format's extension
+  std::string Format;       // fbx, fbx-ascii, fbx6, obj, dae, dxf
+  int Lod;
+  unsigned int Sections;    // MeshSection bits to export, the others are skipped from GetGeometry on
+  unsigned int Attributes;  // MeshAttribute mask of the vertex channels to export
+  int Threads;              // Extraction threads for large trees, 0: one per CPU
+  bool Meshlets;            // Write a .meshlets sidecar next to the output
+  MeshletOptions MeshletLimits;
+  PartitionOptions Partition;
+  bool Cache;               // Write the computed geometry to a .sptc cache next to the output
+  bool Weld;                // Merge identical vertices of a material
+  double WeldEpsilon;       // Grid the channels are rounded to before comparing, 0: exact
+  bool Validate;            // Check the mesh and compute MeshStats
+  MeshBudget Budget;
+};
+
+struct ExportResult
+{
+  ExportResult()
+  {
+    Success = false;
+    Vertices = 0;
+    Triangles = 0;
+    Materials = 0;
+    Meshlets = 0;
+    Nodes = 0;
+    WeldedVertices = 0;
+    OutputBytes = 0;
+    LoadMs = 0.;
+    ComputeMs = 0.;
+    GenerateMs = 0.;
+    SaveMs = 0.;
+    TotalMs = 0.;
+  }
+  bool Success;
+  std::string Error;
+  std::wstring Destination;
+  int Vertices;
+  int Triangles;
+  int Materials;
+  int Meshlets;
+  int Nodes;
+  int WeldedVertices;             // Vertices merged into another by welding
+  unsigned long long OutputBytes; // Size of the saved file
+  double LoadMs;
+  double ComputeMs;
+  double GenerateMs;
+  double SaveMs;
+  double TotalMs;
+  MeshStats Stats;                   // Filled if ExportOptions::Validate is set
+  std::vector<std::string> Warnings; // Invalid geometry and exceeded budgets that didn't fail the export
+};
+
+// Returns the file extension (without a dot) for a format name, or NULL if the format is unknown
+const char *FormatExtension(std::string const &format);
+
+// Loads, computes and exports a single tree. A .sptc path is exported from the geometry
+// cache without SpeedTreeRT. Pass a manager to reuse it across calls, NULL creates a
+// temporary one.
+bool ProcessTree(std::wstring const &sptFilePath, ExportOptions const &options, ExportResult &result, FbxManager *manager = NULL);
+
+bool ExportTree(TreeGeometry const &geometry, std::wstring const &path, ExportOptions const &options, ExportResult &result, FbxManager *manager = NULL);
 
-void ExportTree(CSpeedTreeRT *tree, std::wstring const&destination);
\ No newline at end of file
+#endif // #ifndef _EXPORT_H
@@ -0,0 +1,507 @@
+#include "GeometryCache.h"
+
+#include <cstring>
+#include <vector>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const unsigned int CacheVersion = 1;
+static const int HeaderWords = 16;
+static const int IndexedWords = 13;
+static const int LeafWords = 16;
+static const int CardWords = 32;
+static const int MeshWords = 8;
+
+bool IsGeometryCachePath(std::wstring const &path)
+{
+  const std::wstring suffix(L".sptc");
+  return path.length() >= suffix.length() && path.compare(path.length() - suffix.length(), suffix.length(), suffix) == 0;
+}
+
+// Builds the file in memory, tables are filled in after their arrays are placed
+class CacheWriter
+{
+public:
+  // Returns the offset of a zeroed table of 32-bit words
+  unsigned int AddTable(int words)
+  {
+    Align();
+    const unsigned int offset = (unsigned int)Data.size();
+    Data.resize(Data.size() + words * 4, 0);
+    return offset;
+  }
+
+  // Returns the offset of a copy of the array, 0 if there is nothing to copy
+  unsigned int AddArray(const void *data, size_t bytes)
+  {
+    if (!data || !bytes)
+    {
+      return 0;
+    }
+    Align();
+    const unsigned int offset = (unsigned int)Data.size();
+    Data.insert(Data.end(), (const unsigned char *)data, (const unsigned char *)data + bytes);
+    return offset;
+  }
+
+  void Set(unsigned int table, int word, unsigned int value)
+  {
+    memcpy(&Data[table + word * 4], &value, 4);
+  }
+
+  void SetFloat(unsigned int table, int word, float value)
+  {
+    memcpy(&Data[table + word * 4], &value, 4);
+  }
+
+  std::vector<unsigned char> Data;
+
+private:
+  void Align()
+  {
+    Data.resize((Data.size() + 15) & ~(size_t)15, 0);
+  }
+};
+
+static unsigned int WriteIndexed(CacheWriter &w, IndexedGeometry const &g)
+{
+  if (g.Lods.empty())
+  {
+    return 0;
+  }
+  const size_t n = g.VertexCount;
+  const unsigned int table = w.AddTable(IndexedWords);
+  w.Set(table, 0, (unsigned int)g.VertexCount);
+  w.Set(table, 1, (unsigned int)g.Lods.size());
+  w.Set(table, 2, w.AddArray(g.Coords, n * 3 * sizeof(float)));
+  w.Set(table, 3, w.AddArray(g.Normals, n * 3 * sizeof(float)));
+  w.Set(table, 4, w.AddArray(g.Binormals, n * 3 * sizeof(float)));
+  w.Set(table, 5, w.AddArray(g.Tangents, n * 3 * sizeof(float)));
+  w.Set(table, 6, w.AddArray(g.TexCoords, n * 2 * sizeof(float)));
+  w.Set(table, 7, w.AddArray(g.Colors, n * sizeof(unsigned int)));
+  for (int i = 0; i < 2; ++i)
+  {
+    w.Set(table, 8 + i, w.AddArray(g.WindWeights[i], n * sizeof(float)));
+    w.Set(table, 10 + i, w.AddArray(g.WindMatrixIndices[i], n));
+  }
+
+  const unsigned int lods = w.AddTable((int)g.Lods.size() * 3);
+  w.Set(table, 12, lods);
+  for (size_t lod = 0; lod < g.Lods.size(); ++lod)
+  {
+    IndexedLod const &l = g.Lods[lod];
+    std::vector<int> indices;
+    for (int strip = 0; strip < l.StripCount; ++strip)
+    {
+      indices.insert(indices.end(), l.Strips[strip], l.Strips[strip] + l.StripLengths[strip]);
+    }
+    w.Set(lods, (int)lod * 3, (unsigned int)l.StripCount);
+    w.Set(lods, (int)lod * 3 + 1, w.AddArray(l.StripLengths, l.StripCount * sizeof(int)));
+    w.Set(lods, (int)lod * 3 + 2, indices.empty() ? 0 : w.AddArray(&indices[0], indices.size() * sizeof(int)));
+  }
+  return table;
+}
+
+static unsigned int WriteLeaves(CacheWriter &w, LeafLod const &l)
+{
+  const size_t n = l.LeafCount;
+  const unsigned int table = w.AddTable(LeafWords);
+  w.Set(table, 0, (unsigned int)l.LeafCount);
+  w.Set(table, 1, (unsigned int)l.Cards.size());
+  w.Set(table, 2, (unsigned int)l.Meshes.size());
+  w.Set(table, 3, w.AddArray(l.Centers, n * 3 * sizeof(float)));
+  w.Set(table, 4, w.AddArray(l.Normals, n * 12 * sizeof(float)));
+  w.Set(table, 5, w.AddArray(l.Binormals, n * 12 * sizeof(float)));
+  w.Set(table, 6, w.AddArray(l.Tangents, n * 12 * sizeof(float)));
+  w.Set(table, 7, w.AddArray(l.Colors, n * 4 * sizeof(unsigned int)));
+  w.Set(table, 8, w.AddArray(l.Dimming, n * sizeof(float)));
+  w.Set(table, 9, w.AddArray(l.CardIndices, n));
+  for (int i = 0; i < 2; ++i)
+  {
+    w.Set(table, 10 + i, w.AddArray(l.WindWeights[i], n * sizeof(float)));
+    w.Set(table, 12 + i, w.AddArray(l.WindMatrixIndices[i], n));
+  }
+
+  if (!l.Cards.empty())
+  {
+    const unsigned int cards = w.AddTable((int)l.Cards.size() * CardWords);
+    w.Set(table, 14, cards);
+    for (size_t i = 0; i < l.Cards.size(); ++i)
+    {
+      LeafCard const &card = l.Cards[i];
+      const unsigned int record = cards + (unsigned int)i * CardWords * 4;
+      w.SetFloat(record, 0, card.Width);
+      w.SetFloat(record, 1, card.Height);
+      w.SetFloat(record, 2, card.Pivot[0]);
+      w.SetFloat(record, 3, card.Pivot[1]);
+      memcpy(&w.Data[record + 4 * 4], card.Coords, 16 * sizeof(float));
+      memcpy(&w.Data[record + 20 * 4], card.TexCoords, 8 * sizeof(float));
+      w.Set(record, 28, (unsigned int)card.Mesh);
+    }
+  }
+
+  if (!l.Meshes.empty())
+  {
+    const unsigned int meshes = w.AddTable((int)l.Meshes.size() * MeshWords);
+    w.Set(table, 15, meshes);
+    for (size_t i = 0; i < l.Meshes.size(); ++i)
+    {
+      LeafMesh const &mesh = l.Meshes[i];
+      const size_t v = mesh.VertexCount;
+      const unsigned int record = meshes + (unsigned int)i * MeshWords * 4;
+      w.Set(record, 0, (unsigned int)mesh.VertexCount);
+      w.Set(record, 1, (unsigned int)mesh.IndexCount);
+      w.Set(record, 2, w.AddArray(mesh.Coords, v * 3 * sizeof(float)));
+      w.Set(record, 3, w.AddArray(mesh.Normals, v * 3 * sizeof(float)));
+      w.Set(record, 4, w.AddArray(mesh.Binormals, v * 3 * sizeof(float)));
+      w.Set(record, 5, w.AddArray(mesh.Tangents, v * 3 * sizeof(float)));
+      w.Set(record, 6, w.AddArray(mesh.TexCoords, v * 2 * sizeof(float)));
+      w.Set(record, 7, w.AddArray(mesh.Indices, mesh.IndexCount * sizeof(int)));
+    }
+  }
+  return table;
+}
+
+bool WriteGeometryCache(FILE *f, TreeGeometry const &geometry)
+{
+  CacheWriter w;
+  const unsigned int header = w.AddTable(HeaderWords);
+  memcpy(&w.Data[header], "SPTC", 4);
+  w.Set(header, 1, CacheVersion);
+  if (geometry.UserData)
+  {
+    w.Set(header, 3, w.AddArray(geometry.UserData, strlen(geometry.UserData) + 1));
+  }
+  w.Set(header, 4, WriteIndexed(w, geometry.Branches));
+  w.Set(header, 5, WriteIndexed(w, geometry.Fronds));
+  w.Set(header, 6, (unsigned int)geometry.Leaves.size());
+  if (!geometry.Leaves.empty())
+  {
+    const unsigned int lods = w.AddTable((int)geometry.Leaves.size());
+    w.Set(header, 7, lods);
+    for (size_t lod = 0; lod < geometry.Leaves.size(); ++lod)
+    {
+      w.Set(lods, (int)lod, WriteLeaves(w, geometry.Leaves[lod]));
+    }
+  }
+  w.Set(header, 2, (unsigned int)w.Data.size());
+  return fwrite(&w.Data[0], 1, w.Data.size(), f) == w.Data.size() && ferror(f) == 0;
+}
+
+// Resolves offsets of a mapped cache. Any reference outside of the file clears Ok.
+class CacheReader
+{
+public:
+  CacheReader(const unsigned char *data, size_t size)
+    : Data(data)
+    , Size(size)
+    , Ok(true)
+  {
+  }
+
+  unsigned int Word(unsigned int table, size_t word)
+  {
+    unsigned int value = 0;
+    if (table > Size || (word + 1) * 4 > Size - table)
+    {
+      Ok = false;
+      return 0;
+    }
+    memcpy(&value, Data + table + word * 4, 4);
+    return value;
+  }
+
+  // Reads an element count. Elements take at least elementBytes of the file, which
+  // rejects counts that would overflow array sizes.
+  unsigned int Count(unsigned int table, size_t word, size_t elementBytes)
+  {
+    const unsigned int count = Word(table, word);
+    if (count > Size / elementBytes)
+    {
+      Ok = false;
+      return 0;
+    }
+    return count;
+  }
+
+  float Float(unsigned int table, size_t word)
+  {
+    const unsigned int bits = Word(table, word);
+    float value;
+    memcpy(&value, &bits, 4);
+    return value;
+  }
+
+  // count elements at offset, NULL if the offset is 0. A required array must be present unless it's empty.
+  template<typename T>
+  const T *Array(unsigned int offset, size_t count, bool required = false)
+  {
+    if (!offset)
+    {
+      Ok = Ok && !(required && count);
+      return NULL;
+    }
+    if (offset % 4 || offset > Size || count > (Size - offset) / sizeof(T))
+    {
+      Ok = false;
+      return NULL;
+    }
+    return (const T *)(Data + offset);
+  }
+
+  const unsigned char *Data;
+  size_t Size;
+  bool Ok;
+};
+
+static bool ReadIndexed(CacheReader &r, unsigned int table, IndexedGeometry &g)
+{
+  if (!table)
+  {
+    return true;
+  }
+  g.VertexCount = (int)r.Count(table, 0, 14 * sizeof(float));
+  const size_t n = g.VertexCount;
+  const unsigned int lodCount = r.Count(table, 1, 3 * 4);
+  g.Coords = r.Array<float>(r.Word(table, 2), n * 3, true);
+  g.Normals = r.Array<float>(r.Word(table, 3), n * 3, true);
+  g.Binormals = r.Array<float>(r.Word(table, 4), n * 3, true);
+  g.Tangents = r.Array<float>(r.Word(table, 5), n * 3, true);
+  g.TexCoords = r.Array<float>(r.Word(table, 6), n * 2, true);
+  g.Colors = r.Array<unsigned int>(r.Word(table, 7), n);
+  for (int i = 0; i < 2; ++i)
+  {
+    g.WindWeights[i] = r.Array<float>(r.Word(table, 8 + i), n);
+    g.WindMatrixIndices[i] = r.Array<unsigned char>(r.Word(table, 10 + i), n);
+  }
+
+  const unsigned int lods = r.Word(table, 12);
+  for (unsigned int lod = 0; r.Ok && lod < lodCount; ++lod)
+  {
+    IndexedLod l;
+    l.StripCount = (int)r.Count(lods, lod * 3, sizeof(int));
+    l.StripLengths = r.Array<int>(r.Word(lods, lod * 3 + 1), l.StripCount, true);
+    size_t total = 0;
+    for (int strip = 0; r.Ok && strip < l.StripCount; ++strip)
+    {
+      total += l.StripLengths[strip];
+      r.Ok = l.StripLengths[strip] >= 0 && total <= r.Size / sizeof(int);
+    }
+    const int *indices = r.Array<int>(r.Word(lods, lod * 3 + 2), total, true);
+    for (size_t i = 0; r.Ok && i < total; ++i)
+    {
+      r.Ok = indices[i] >= 0 && indices[i] < g.VertexCount;
+    }
+    for (int strip = 0; r.Ok && strip < l.StripCount; ++strip)
+    {
+      l.Strips.push_back(indices);
+      indices += l.StripLengths[strip];
+    }
+    g.Lods.push_back(l);
+  }
+  return r.Ok;
+}
+
+static bool ReadLeaves(CacheReader &r, unsigned int table, LeafLod &l)
+{
+  if (!table)
+  {
+    return false;
+  }
+  l.LeafCount = (int)r.Count(table, 0, 40 * sizeof(float));
+  const size_t n = l.LeafCount;
+  const unsigned int cardCount = r.Count(table, 1, CardWords * 4);
+  const unsigned int meshCount = r.Count(table, 2, MeshWords * 4);
+  l.Centers = r.Array<float>(r.Word(table, 3), n * 3, true);
+  l.Normals = r.Array<float>(r.Word(table, 4), n * 12, true);
+  l.Binormals = r.Array<float>(r.Word(table, 5), n * 12, true);
+  l.Tangents = r.Array<float>(r.Word(table, 6), n * 12, true);
+  l.Colors = r.Array<unsigned int>(r.Word(table, 7), n * 4);
+  l.Dimming = r.Array<float>(r.Word(table, 8), n, true);
+  l.CardIndices = r.Array<unsigned char>(r.Word(table, 9), n, true);
+  for (int i = 0; i < 2; ++i)
+  {
+    l.WindWeights[i] = r.Array<float>(r.Word(table, 10 + i), n);
+    l.WindMatrixIndices[i] = r.Array<unsigned char>(r.Word(table, 12 + i), n);
+  }
+  for (size_t leaf = 0; r.Ok && leaf < n; ++leaf)
+  {
+    r.Ok = l.CardIndices[leaf] < cardCount;
+  }
+
+  const unsigned int meshes = r.Word(table, 15);
+  r.Array<unsigned int>(meshes, meshCount * MeshWords, true);
+  for (unsigned int i = 0; r.Ok && i < meshCount; ++i)
+  {
+    const unsigned int record = meshes + i * MeshWords * 4;
+    LeafMesh mesh;
+    mesh.VertexCount = (int)r.Count(record, 0, 14 * sizeof(float));
+    mesh.IndexCount = (int)r.Count(record, 1, sizeof(int));
+    const size_t v = mesh.VertexCount;
+    mesh.Coords = r.Array<float>(r.Word(record, 2), v * 3, true);
+    mesh.Normals = r.Array<float>(r.Word(record, 3), v * 3, true);
+    mesh.Binormals = r.Array<float>(r.Word(record, 4), v * 3, true);
+    mesh.Tangents = r.Array<float>(r.Word(record, 5), v * 3, true);
+    mesh.TexCoords = r.Array<float>(r.Word(record, 6), v * 2, true);
+    mesh.Indices = r.Array<int>(r.Word(record, 7), (size_t)mesh.IndexCount, true);
+    for (int k = 0; r.Ok && k < mesh.IndexCount; ++k)
+    {
+      r.Ok = mesh.Indices[k] >= 0 && mesh.Indices[k] < mesh.VertexCount;
+    }
+    l.Meshes.push_back(mesh);
+  }
+
+  const unsigned int cards = r.Word(table, 14);
+  const float *records = r.Array<float>(cards, cardCount * CardWords, true);
+  for (unsigned int i = 0; r.Ok && i < cardCount; ++i)
+  {
+    const unsigned int record = cards + i * CardWords * 4;
+    LeafCard card;
+    card.Width = r.Float(record, 0);
+    card.Height = r.Float(record, 1);
+    card.Pivot[0] = r.Float(record, 2);
+    card.Pivot[1] = r.Float(record, 3);
+    card.Coords = records + i * CardWords + 4;
+    card.TexCoords = records + i * CardWords + 20;
+    card.Mesh = (int)r.Word(record, 28);
+    r.Ok = card.Mesh >= -1 && card.Mesh < (int)meshCount;
+    l.Cards.push_back(card);
+  }
+  return r.Ok;
+}
+
+GeometryCache::GeometryCache()
+  : Data(NULL)
+  , Size(0)
+  , File(NULL)
+  , Mapping(NULL)
+{
+}
+
+GeometryCache::~GeometryCache()
+{
+  Close();
+}
+
+bool GeometryCache::Open(std::wstring const &path, std::string &error)
+{
+  Close();
+#ifdef _WIN32
+  HANDLE file = CreateFileW(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+  {
+    error = "Failed to open";
+    return false;
+  }
+  File = file;
+  LARGE_INTEGER size;
+  if (GetFileSizeEx(file, &size) && size.QuadPart >= HeaderWords * 4 && size.HighPart == 0)
+  {
+    Mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    Data = Mapping ? (const unsigned char *)MapViewOfFile(Mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    Size = (size_t)size.QuadPart;
+  }
+#else
+  std::vector<char> name(path.size() * 4 + 1);
+  if (wcstombs(&name[0], path.c_str(), name.size()) == (size_t)-1)
+  {
+    error = "Failed to open";
+    return false;
+  }
+  const int fd = open(&name[0], O_RDONLY);
+  if (fd == -1)
+  {
+    error = "Failed to open";
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) == 0 && st.st_size >= HeaderWords * 4 && (unsigned long long)st.st_size < 0x100000000ULL)
+  {
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    Data = data == MAP_FAILED ? NULL : (const unsigned char *)data;
+    Size = (size_t)st.st_size;
+  }
+  close(fd);
+#endif
+  if (!Data)
+  {
+    error = "File corrupted";
+    Close();
+    return false;
+  }
+
+  CacheReader r(Data, Size);
+  if (memcmp(Data, "SPTC", 4))
+  {
+    error = "Not a geometry cache";
+  }
+  else if (r.Word(0, 1) != CacheVersion)
+  {
+    error = "Unsupported geometry cache version";
+  }
+  else if (r.Word(0, 2) != Size)
+  {
+    error = "Geometry cache truncated";
+  }
+  else
+  {
+    const unsigned int userData = r.Word(0, 3);
+    if (userData)
+    {
+      Geometry.UserData = r.Array<char>(userData, 1, true);
+      r.Ok = r.Ok && memchr(Geometry.UserData, 0, Size - userData) != NULL;
+    }
+    bool ok = r.Ok && ReadIndexed(r, r.Word(0, 4), Geometry.Branches) && ReadIndexed(r, r.Word(0, 5), Geometry.Fronds);
+    const unsigned int lodCount = r.Count(0, 6, LeafWords * 4);
+    const unsigned int lods = r.Word(0, 7);
+    r.Array<unsigned int>(lods, lodCount, true);
+    for (unsigned int lod = 0; ok && r.Ok && lod < lodCount; ++lod)
+    {
+      Geometry.Leaves.push_back(LeafLod());
+      ok = ReadLeaves(r, r.Word(lods, lod), Geometry.Leaves.back());
+    }
+    if (ok && r.Ok)
+    {
+      return true;
+    }
+    error = "Geometry cache corrupted";
+  }
+  Close();
+  return false;
+}
+
+void GeometryCache::Close()
+{
+#ifdef _WIN32
+  if (Data)
+  {
+    UnmapViewOfFile(Data);
+  }
+  if (Mapping)
+  {
+    CloseHandle(Mapping);
+  }
+  if (File)
+  {
+    CloseHandle(File);
+  }
+#else
+  if (Data)
+  {
+    munmap((void *)Data, Size);
+  }
+#endif
+  Data = NULL;
+  Size = 0;
+  File = NULL;
+  Mapping = NULL;
+  Geometry = TreeGeometry();
+}
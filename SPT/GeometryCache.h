@@ -0,0 +1,56 @@
+#ifndef _GEOMETRY_CACHE_H
+#define _GEOMETRY_CACHE_H
+
+#include "TreeGeometry.h"
+
+#include <cstdio>
+#include <string>
+
+// Computed tree geometry on disk (.sptc), so re-exports skip SpeedTreeRT entirely.
+// The file is laid out to be mapped and used in place: a header of 32-bit words,
+// tables of 32-bit words and 16-byte aligned arrays, all referenced by file offsets.
+// Everything is stored in the byte order of the writer, which is little-endian on
+// every platform SpeedTreeRT exists for.
+//
+//   header:   "SPTC", version, file size, user data, branches, fronds, leaf LOD count, leaf LOD table, 8 reserved
+//   indexed:  vertex count, LOD count, coords, normals, binormals, tangents, tex coords, colors,
+//             wind weights 0/1, wind matrix indices 0/1, LOD table (strip count, lengths, indices per LOD)
+//   leaf LOD: leaf count, card count, mesh count, centers, normals, binormals, tangents, colors,
+//             dimming, card indices, wind weights 0/1, wind matrix indices 0/1, cards, meshes
+//   card:     width, height, pivot uv, coords[16], tex coords[8], mesh index or -1, 3 reserved
+//   mesh:     vertex count, index count, coords, normals, binormals, tangents, tex coords, indices
+//
+// Offsets of 0 mark arrays the tree doesn't have.
+
+bool IsGeometryCachePath(std::wstring const &path);
+
+bool WriteGeometryCache(FILE *f, TreeGeometry const &geometry);
+
+// Maps a cache read-only. The geometry points into the mapping and stays valid until Close.
+class GeometryCache
+{
+public:
+  GeometryCache();
+  ~GeometryCache();
+
+  // Validates the layout and every index, error is set on failure
+  bool Open(std::wstring const &path, std::string &error);
+  void Close();
+
+  TreeGeometry const &GetGeometry() const
+  {
+    return Geometry;
+  }
+
+private:
+  GeometryCache(GeometryCache const&);
+  GeometryCache &operator=(GeometryCache const&);
+
+  const unsigned char *Data;
+  size_t Size;
+  void *File;
+  void *Mapping;
+  TreeGeometry Geometry;
+};
+
+#endif // #ifndef _GEOMETRY_CACHE_H
@@ -0,0 +1,222 @@
+#include "Job.h"
+#include "Common.h"
+
+bool ParseJob(JsonValue const &value, Job &job, std::string &error)
+{
+  if (!value.IsObject())
+  {
+    error = "Job must be a JSON object";
+    return false;
+  }
+  job.Id = value.GetString("id");
+  job.Input = a2w(value.GetString("input"));
+  if (job.Input.empty())
+  {
+    error = "Job has no input";
+    return false;
+  }
+  job.Options.Destination = a2w(value.GetString("output"));
+  job.Options.Format = value.GetString("format", job.Options.Format);
+  if (!FormatExtension(job.Options.Format))
+  {
+    error = "Unknown format: " + job.Options.Format;
+    return false;
+  }
+  if (const JsonValue *options = value.Find("options"))
+  {
+    job.Options.Lod = (int)options->GetNumber("lod", job.Options.Lod);
+    job.Options.Meshlets = options->GetBool("meshlets", job.Options.Meshlets);
+    job.Options.MeshletLimits.MaxVertices = (int)options->GetNumber("meshlet_vertices", job.Options.MeshletLimits.MaxVertices);
+    job.Options.MeshletLimits.MaxTriangles = (int)options->GetNumber("meshlet_triangles", job.Options.MeshletLimits.MaxTriangles);
+    job.Options.Partition.Leaves = options->GetBool("split_leaves", job.Options.Partition.Leaves);
+    job.Options.Partition.Fronds = options->GetBool("split_fronds", job.Options.Partition.Fronds);
+    job.Options.Partition.LeavesPerCluster = (int)options->GetNumber("leaves_per_cluster", job.Options.Partition.LeavesPerCluster);
+    job.Options.Partition.FrondTrianglesPerCluster = (int)options->GetNumber("frond_triangles_per_cluster", job.Options.Partition.FrondTrianglesPerCluster);
+    job.Options.Cache = options->GetBool("cache", job.Options.Cache);
+    job.Options.Threads = (int)options->GetNumber("threads", job.Options.Threads);
+    const std::string sections = options->GetString("sections");
+    if (!sections.empty() && !ParseSections(sections, job.Options.Sections))
+    {
+      error = "Invalid sections: " + sections;
+      return false;
+    }
+    const std::string attrs = options->GetString("attrs");
+    if (!attrs.empty() && !ParseAttributes(attrs, job.Options.Attributes))
+    {
+      error = "Invalid attributes: " + attrs;
+      return false;
+    }
+    if (options->GetBool("wind", false))
+    {
+      job.Options.Attributes |= AttrWind;
+    }
+    job.Options.Weld = options->GetBool("weld", job.Options.Weld);
+    job.Options.WeldEpsilon = options->GetNumber("weld_epsilon", job.Options.WeldEpsilon);
+    job.Options.Validate = options->GetBool("validate", job.Options.Validate);
+    job.Options.Budget.MaxTriangles = (int)options->GetNumber("max_triangles", job.Options.Budget.MaxTriangles);
+    job.Options.Budget.MaxVertices = (int)options->GetNumber("max_vertices", job.Options.Budget.MaxVertices);
+    job.Options.Budget.MaxBytes = (unsigned long long)options->GetNumber("max_bytes", (double)job.Options.Budget.MaxBytes);
+    const std::string budget = options->GetString("budget", job.Options.Budget.Fail ? "fail" : "warn");
+    if (budget != "warn" && budget != "fail")
+    {
+      error = "Unknown budget mode: " + budget;
+      return false;
+    }
+    job.Options.Budget.Fail = budget == "fail";
+  }
+  if (job.Options.Lod < 0)
+  {
+    error = "Invalid lod";
+    return false;
+  }
+  if (job.Options.WeldEpsilon < 0.)
+  {
+    error = "Invalid weld epsilon";
+    return false;
+  }
+  if (job.Options.Budget.MaxTriangles < 0 || job.Options.Budget.MaxVertices < 0)
+  {
+    error = "Invalid budget";
+    return false;
+  }
+  if (job.Options.Partition.LeavesPerCluster < 1 || job.Options.Partition.FrondTrianglesPerCluster < 1)
+  {
+    error = "Invalid cluster size";
+    return false;
+  }
+  if (!IsValid(job.Options.MeshletLimits))
+  {
+    error = "Invalid meshlet limits";
+    return false;
+  }
+  return true;
+}
+
+std::string FormatResult(Job const &job, ExportResult const &result)
+{
+  JsonWriter w;
+  w.BeginObject();
+  w.Key("id");
+  w.String(job.Id);
+  w.Key("status");
+  w.String(result.Success ? "ok" : "error");
+  if (!result.Success)
+  {
+    w.Key("error");
+    w.String(result.Error);
+  }
+  w.Key("input");
+  w.String(w2a(job.Input));
+  w.Key("output");
+  w.String(w2a(result.Destination));
+  w.Key("format");
+  w.String(job.Options.Format);
+  if (job.Options.Sections != AllSections)
+  {
+    w.Key("sections");
+    w.String(FormatSections(job.Options.Sections));
+  }
+  w.Key("attributes");
+  w.String(FormatAttributes(job.Options.Attributes));
+  w.Key("output_bytes");
+  w.Int((long long)result.OutputBytes);
+  w.Key("timings");
+  w.BeginObject();
+  w.Key("load_ms");
+  w.Number(result.LoadMs);
+  w.Key("compute_ms");
+  w.Number(result.ComputeMs);
+  w.Key("generate_ms");
+  w.Number(result.GenerateMs);
+  w.Key("save_ms");
+  w.Number(result.SaveMs);
+  w.Key("total_ms");
+  w.Number(result.TotalMs);
+  w.EndObject();
+  w.Key("counts");
+  w.BeginObject();
+  w.Key("vertices");
+  w.Int(result.Vertices);
+  w.Key("triangles");
+  w.Int(result.Triangles);
+  w.Key("materials");
+  w.Int(result.Materials);
+  w.Key("nodes");
+  w.Int(result.Nodes);
+  if (job.Options.Meshlets)
+  {
+    w.Key("meshlets");
+    w.Int(result.Meshlets);
+  }
+  if (job.Options.Weld)
+  {
+    w.Key("welded_vertices");
+    w.Int(result.WeldedVertices);
+  }
+  w.EndObject();
+  if (job.Options.Validate)
+  {
+    MeshStats const &stats = result.Stats;
+    w.Key("validation");
+    w.BeginObject();
+    w.Key("out_of_range_triangles");
+    w.Int(stats.OutOfRangeTriangles);
+    w.Key("degenerate_triangles");
+    w.Int(stats.DegenerateTriangles);
+    w.Key("duplicate_triangles");
+    w.Int(stats.DuplicateTriangles);
+    w.Key("invalid_vertices");
+    w.Int(stats.InvalidVertices);
+    w.Key("unreferenced_vertices");
+    w.Int(stats.UnreferencedVertices);
+    w.Key("bounds_min");
+    w.BeginArray();
+    for (int k = 0; k < 3; ++k)
+    {
+      w.Number(stats.BoundsMin[k]);
+    }
+    w.EndArray();
+    w.Key("bounds_max");
+    w.BeginArray();
+    for (int k = 0; k < 3; ++k)
+    {
+      w.Number(stats.BoundsMax[k]);
+    }
+    w.EndArray();
+    w.Key("surface_area");
+    w.Number(stats.SurfaceArea);
+    w.Key("leaf_area");
+    w.Number(stats.LeafArea);
+    w.Key("triangle_density");
+    w.Number(stats.TriangleDensity);
+    w.Key("leaf_overdraw");
+    w.Number(stats.LeafOverdraw);
+    w.EndObject();
+  }
+  if (!result.Warnings.empty())
+  {
+    w.Key("warnings");
+    w.BeginArray();
+    for (size_t i = 0; i < result.Warnings.size(); ++i)
+    {
+      w.String(result.Warnings[i]);
+    }
+    w.EndArray();
+  }
+  w.EndObject();
+  return w.Str();
+}
+
+std::string FormatError(std::string const &id, std::string const &error)
+{
+  JsonWriter w;
+  w.BeginObject();
+  w.Key("id");
+  w.String(id);
+  w.Key("status");
+  w.String("error");
+  w.Key("error");
+  w.String(error);
+  w.EndObject();
+  return w.Str();
+}
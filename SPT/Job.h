@@ -0,0 +1,24 @@
+#ifndef _JOB_H
+#define _JOB_H
+
+#include "Export.h"
+#include "Json.h"
+
+#include <string>
+
+// A single conversion request of the batch protocol:
+// {"id": "oak", "input": "C:\\trees\\oak.spt", "output": "C:\\out\\oak.fbx", "format": "fbx", "options": {"lod": 0}}
+struct Job
+{
+  std::string Id;
+  std::wstring Input;
+  ExportOptions Options;
+};
+
+bool ParseJob(JsonValue const &value, Job &job, std::string &error);
+
+// Serializes the outcome of a job as a single JSON line (without the line break)
+std::string FormatResult(Job const &job, ExportResult const &result);
+std::string FormatError(std::string const &id, std::string const &error);
+
+#endif // #ifndef _JOB_H
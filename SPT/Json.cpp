@@ -0,0 +1,537 @@
+#include "Json.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+JsonValue::JsonValue()
+  : ValueType(Null)
+  , BoolValue(false)
+  , NumberValue(0.)
+{
+}
+
+const JsonValue *JsonValue::Find(const char *key) const
+{
+  if (ValueType != Object)
+  {
+    return NULL;
+  }
+  for (size_t i = 0; i < Members.size(); ++i)
+  {
+    if (Members[i].first == key)
+    {
+      return &Members[i].second;
+    }
+  }
+  return NULL;
+}
+
+std::string JsonValue::GetString(const char *key, std::string const &def) const
+{
+  const JsonValue *v = Find(key);
+  return v && v->ValueType == String ? v->StringValue : def;
+}
+
+double JsonValue::GetNumber(const char *key, double def) const
+{
+  const JsonValue *v = Find(key);
+  return v && v->ValueType == Number ? v->NumberValue : def;
+}
+
+bool JsonValue::GetBool(const char *key, bool def) const
+{
+  const JsonValue *v = Find(key);
+  return v && v->ValueType == Bool ? v->BoolValue : def;
+}
+
+class JsonParser
+{
+public:
+  JsonParser(std::string const &text)
+    : Text(text)
+    , Pos(0)
+  {
+  }
+
+  bool Parse(JsonValue &value, std::string &error)
+  {
+    if (!ParseValue(value, 0))
+    {
+      error = Error;
+      return false;
+    }
+    SkipSpaces();
+    if (Pos != Text.size())
+    {
+      error = Fail("Unexpected trailing characters");
+      return false;
+    }
+    return true;
+  }
+
+private:
+  std::string Fail(const char *msg)
+  {
+    char buf[128];
+    sprintf(buf, "%s at offset %u", msg, (unsigned)Pos);
+    Error = buf;
+    return Error;
+  }
+
+  void SkipSpaces()
+  {
+    while (Pos < Text.size() && (Text[Pos] == ' ' || Text[Pos] == '\t' || Text[Pos] == '\r' || Text[Pos] == '\n'))
+    {
+      Pos++;
+    }
+  }
+
+  bool Match(const char *word)
+  {
+    size_t len = strlen(word);
+    if (Text.compare(Pos, len, word) == 0)
+    {
+      Pos += len;
+      return true;
+    }
+    return false;
+  }
+
+  static void AppendUtf8(std::string &out, unsigned int cp)
+  {
+    if (cp < 0x80)
+    {
+      out += (char)cp;
+    }
+    else if (cp < 0x800)
+    {
+      out += (char)(0xC0 | (cp >> 6));
+      out += (char)(0x80 | (cp & 0x3F));
+    }
+    else if (cp < 0x10000)
+    {
+      out += (char)(0xE0 | (cp >> 12));
+      out += (char)(0x80 | ((cp >> 6) & 0x3F));
+      out += (char)(0x80 | (cp & 0x3F));
+    }
+    else
+    {
+      out += (char)(0xF0 | (cp >> 18));
+      out += (char)(0x80 | ((cp >> 12) & 0x3F));
+      out += (char)(0x80 | ((cp >> 6) & 0x3F));
+      out += (char)(0x80 | (cp & 0x3F));
+    }
+  }
+
+  bool ParseHex4(unsigned int &cp)
+  {
+    if (Pos + 4 > Text.size())
+    {
+      Fail("Truncated escape");
+      return false;
+    }
+    cp = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+      char c = Text[Pos++];
+      cp <<= 4;
+      if (c >= '0' && c <= '9') cp |= c - '0';
+      else if (c >= 'a' && c <= 'f') cp |= c - 'a' + 10;
+      else if (c >= 'A' && c <= 'F') cp |= c - 'A' + 10;
+      else
+      {
+        Fail("Bad unicode escape");
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Length of the number at Pos by the JSON grammar: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+  // 0 if the text there isn't one
+  size_t ScanNumber() const
+  {
+    size_t i = Pos;
+    if (i < Text.size() && Text[i] == '-')
+    {
+      i++;
+    }
+    if (i < Text.size() && Text[i] == '0')
+    {
+      i++;
+    }
+    else if (i < Text.size() && Text[i] >= '1' && Text[i] <= '9')
+    {
+      while (i < Text.size() && Text[i] >= '0' && Text[i] <= '9')
+      {
+        i++;
+      }
+    }
+    else
+    {
+      return 0;
+    }
+    if (i < Text.size() && Text[i] == '.')
+    {
+      const size_t digits = ++i;
+      while (i < Text.size() && Text[i] >= '0' && Text[i] <= '9')
+      {
+        i++;
+      }
+      if (i == digits)
+      {
+        return 0;
+      }
+    }
+    if (i < Text.size() && (Text[i] == 'e' || Text[i] == 'E'))
+    {
+      i++;
+      if (i < Text.size() && (Text[i] == '+' || Text[i] == '-'))
+      {
+        i++;
+      }
+      const size_t digits = i;
+      while (i < Text.size() && Text[i] >= '0' && Text[i] <= '9')
+      {
+        i++;
+      }
+      if (i == digits)
+      {
+        return 0;
+      }
+    }
+    return i - Pos;
+  }
+
+  bool ParseString(std::string &out)
+  {
+    // Caller checked the opening quote
+    Pos++;
+    while (Pos < Text.size())
+    {
+      char c = Text[Pos++];
+      if (c == '"')
+      {
+        return true;
+      }
+      if (c != '\\')
+      {
+        out += c;
+        continue;
+      }
+      if (Pos >= Text.size())
+      {
+        break;
+      }
+      c = Text[Pos++];
+      switch (c)
+      {
+        case '"': out += '"'; break;
+        case '\\': out += '\\'; break;
+        case '/': out += '/'; break;
+        case 'b': out += '\b'; break;
+        case 'f': out += '\f'; break;
+        case 'n': out += '\n'; break;
+        case 'r': out += '\r'; break;
+        case 't': out += '\t'; break;
+        case 'u':
+        {
+          unsigned int cp = 0;
+          if (!ParseHex4(cp))
+          {
+            return false;
+          }
+          if (cp >= 0xD800 && cp < 0xDC00 && Match("\\u"))
+          {
+            unsigned int lo = 0;
+            if (!ParseHex4(lo))
+            {
+              return false;
+            }
+            if (lo < 0xDC00 || lo > 0xDFFF)
+            {
+              Fail("Bad surrogate");
+              return false;
+            }
+            cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+          }
+          AppendUtf8(out, cp);
+          break;
+        }
+        default:
+          Fail("Bad escape");
+          return false;
+      }
+    }
+    Fail("Unterminated string");
+    return false;
+  }
+
+  bool ParseValue(JsonValue &value, int depth)
+  {
+    if (depth > 64)
+    {
+      Fail("Document is nested too deep");
+      return false;
+    }
+    SkipSpaces();
+    if (Pos >= Text.size())
+    {
+      Fail("Unexpected end of input");
+      return false;
+    }
+    char c = Text[Pos];
+    if (c == '{')
+    {
+      Pos++;
+      value.ValueType = JsonValue::Object;
+      SkipSpaces();
+      if (Pos < Text.size() && Text[Pos] == '}')
+      {
+        Pos++;
+        return true;
+      }
+      while (true)
+      {
+        SkipSpaces();
+        if (Pos >= Text.size() || Text[Pos] != '"')
+        {
+          Fail("Expected a key");
+          return false;
+        }
+        value.Members.push_back(std::make_pair(std::string(), JsonValue()));
+        if (!ParseString(value.Members.back().first))
+        {
+          return false;
+        }
+        SkipSpaces();
+        if (Pos >= Text.size() || Text[Pos] != ':')
+        {
+          Fail("Expected ':'");
+          return false;
+        }
+        Pos++;
+        if (!ParseValue(value.Members.back().second, depth + 1))
+        {
+          return false;
+        }
+        SkipSpaces();
+        if (Pos < Text.size() && Text[Pos] == ',')
+        {
+          Pos++;
+          continue;
+        }
+        if (Pos < Text.size() && Text[Pos] == '}')
+        {
+          Pos++;
+          return true;
+        }
+        Fail("Expected ',' or '}'");
+        return false;
+      }
+    }
+    if (c == '[')
+    {
+      Pos++;
+      value.ValueType = JsonValue::Array;
+      SkipSpaces();
+      if (Pos < Text.size() && Text[Pos] == ']')
+      {
+        Pos++;
+        return true;
+      }
+      while (true)
+      {
+        value.Items.push_back(JsonValue());
+        if (!ParseValue(value.Items.back(), depth + 1))
+        {
+          return false;
+        }
+        SkipSpaces();
+        if (Pos < Text.size() && Text[Pos] == ',')
+        {
+          Pos++;
+          continue;
+        }
+        if (Pos < Text.size() && Text[Pos] == ']')
+        {
+          Pos++;
+          return true;
+        }
+        Fail("Expected ',' or ']'");
+        return false;
+      }
+    }
+    if (c == '"')
+    {
+      value.ValueType = JsonValue::String;
+      return ParseString(value.StringValue);
+    }
+    if (Match("true"))
+    {
+      value.ValueType = JsonValue::Bool;
+      value.BoolValue = true;
+      return true;
+    }
+    if (Match("false"))
+    {
+      value.ValueType = JsonValue::Bool;
+      value.BoolValue = false;
+      return true;
+    }
+    if (Match("null"))
+    {
+      value.ValueType = JsonValue::Null;
+      return true;
+    }
+    if (c == '-' || (c >= '0' && c <= '9'))
+    {
+      // strtod alone would also take inf, nan, hex floats and "1."
+      const size_t length = ScanNumber();
+      const char *begin = Text.c_str() + Pos;
+      char *end = NULL;
+      value.ValueType = JsonValue::Number;
+      value.NumberValue = length ? strtod(begin, &end) : 0.;
+      if (!length || end != begin + length)
+      {
+        Fail("Bad number");
+        return false;
+      }
+      Pos += length;
+      return true;
+    }
+    Fail("Unexpected character");
+    return false;
+  }
+
+  std::string const &Text;
+  size_t Pos;
+  std::string Error;
+};
+
+bool ParseJson(std::string const &text, JsonValue &value, std::string &error)
+{
+  value = JsonValue();
+  JsonParser parser(text);
+  return parser.Parse(value, error);
+}
+
+JsonWriter::JsonWriter()
+  : AfterKey(false)
+{
+}
+
+void JsonWriter::Separate()
+{
+  if (AfterKey)
+  {
+    AfterKey = false;
+    return;
+  }
+  if (!First.empty())
+  {
+    if (!First.back())
+    {
+      Buffer += ',';
+    }
+    First.back() = false;
+  }
+}
+
+void JsonWriter::BeginObject()
+{
+  Separate();
+  Buffer += '{';
+  First.push_back(true);
+}
+
+void JsonWriter::EndObject()
+{
+  Buffer += '}';
+  First.pop_back();
+}
+
+void JsonWriter::BeginArray()
+{
+  Separate();
+  Buffer += '[';
+  First.push_back(true);
+}
+
+void JsonWriter::EndArray()
+{
+  Buffer += ']';
+  First.pop_back();
+}
+
+void JsonWriter::Key(const char *key)
+{
+  String(key);
+  Buffer += ':';
+  AfterKey = true;
+}
+
+void JsonWriter::String(std::string const &value)
+{
+  Separate();
+  Buffer += '"';
+  for (size_t i = 0; i < value.size(); ++i)
+  {
+    unsigned char c = (unsigned char)value[i];
+    switch (c)
+    {
+      case '"': Buffer += "\\\""; break;
+      case '\\': Buffer += "\\\\"; break;
+      case '\n': Buffer += "\\n"; break;
+      case '\r': Buffer += "\\r"; break;
+      case '\t': Buffer += "\\t"; break;
+      default:
+        if (c < 0x20)
+        {
+          char esc[8];
+          sprintf(esc, "\\u%04x", c);
+          Buffer += esc;
+        }
+        else
+        {
+          Buffer += (char)c;
+        }
+        break;
+    }
+  }
+  Buffer += '"';
+}
+
+void JsonWriter::Number(double value, int precision)
+{
+  if (value != value)
+  {
+    Null();
+    return;
+  }
+  Separate();
+  char buf[64];
+  sprintf(buf, "%.*f", precision, value);
+  Buffer += buf;
+}
+
+void JsonWriter::Int(long long value)
+{
+  Separate();
+  char buf[32];
+  sprintf(buf, "%lld", value);
+  Buffer += buf;
+}
+
+void JsonWriter::Bool(bool value)
+{
+  Separate();
+  Buffer += value ? "true" : "false";
+}
+
+void JsonWriter::Null()
+{
+  Separate();
+  Buffer += "null";
+}
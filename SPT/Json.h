@@ -0,0 +1,88 @@
+#ifndef _JSON_H
+#define _JSON_H
+
+#include <string>
+#include <vector>
+#include <utility>
+
+// Minimal JSON support for the job protocol and run reports.
+// Only what the tool needs: parse a single document, read members, write flat records.
+
+class JsonValue
+{
+public:
+  enum Type
+  {
+    Null,
+    Bool,
+    Number,
+    String,
+    Array,
+    Object
+  };
+
+  JsonValue();
+
+  Type GetType() const { return ValueType; }
+  bool IsNull() const { return ValueType == Null; }
+  bool IsObject() const { return ValueType == Object; }
+  bool IsArray() const { return ValueType == Array; }
+
+  // Object member lookup. Returns NULL if the value is not an object or has no such key.
+  const JsonValue *Find(const char *key) const;
+
+  std::string GetString(const char *key, std::string const &def = std::string()) const;
+  double GetNumber(const char *key, double def = 0.) const;
+  bool GetBool(const char *key, bool def = false) const;
+
+  std::string const &AsString() const { return StringValue; }
+  double AsNumber() const { return NumberValue; }
+  bool AsBool() const { return BoolValue; }
+
+  size_t Size() const { return ValueType == Object ? Members.size() : Items.size(); }
+  JsonValue const &operator[](size_t idx) const { return Items[idx]; }
+  std::string const &KeyAt(size_t idx) const { return Members[idx].first; }
+  JsonValue const &MemberAt(size_t idx) const { return Members[idx].second; }
+
+private:
+  friend class JsonParser;
+
+  Type ValueType;
+  bool BoolValue;
+  double NumberValue;
+  std::string StringValue;
+  std::vector<JsonValue> Items;
+  std::vector<std::pair<std::string, JsonValue> > Members;
+};
+
+bool ParseJson(std::string const &text, JsonValue &value, std::string &error);
+
+// Streams a single JSON document into a string. Commas are inserted automatically.
+class JsonWriter
+{
+public:
+  JsonWriter();
+
+  void BeginObject();
+  void EndObject();
+  void BeginArray();
+  void EndArray();
+  void Key(const char *key);
+
+  void String(std::string const &value);
+  void Number(double value, int precision = 3);
+  void Int(long long value);
+  void Bool(bool value);
+  void Null();
+
+  std::string const &Str() const { return Buffer; }
+
+private:
+  void Separate();
+
+  std::string Buffer;
+  std::vector<bool> First;
+  bool AfterKey;
+};
+
+#endif // #ifndef _JSON_H
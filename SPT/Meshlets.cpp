@@ -0,0 +1,323 @@
+#include "Meshlets.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+static const unsigned int MeshletFileVersion = 2;
+
+bool IsValid(MeshletOptions const &options)
+{
+  return options.MaxVertices >= 3 && options.MaxVertices <= 256 && options.MaxTriangles >= 1 && options.MaxTriangles <= 512;
+}
+
+// Spreads the lower 10 bits of v so that there are two zero bits between each of them
+static unsigned int ExpandBits(unsigned int v)
+{
+  v = (v * 0x00010001u) & 0xFF0000FFu;
+  v = (v * 0x00000101u) & 0x0F00F00Fu;
+  v = (v * 0x00000011u) & 0xC30C30C3u;
+  v = (v * 0x00000005u) & 0x49249249u;
+  return v;
+}
+
+struct MortonKey
+{
+  unsigned int Code;
+  int Element;
+  bool operator<(MortonKey const &other) const
+  {
+    return Code != other.Code ? Code < other.Code : Element < other.Element;
+  }
+};
+
+// Returns the triangles of one material in the order they should be packed
+static void OrderTriangles(TreeMesh const &mesh, std::vector<int> const &triangles, std::vector<int> &ordered)
+{
+  ordered.clear();
+  std::vector<int> leafTriangles;
+  for (size_t i = 0; i < triangles.size(); ++i)
+  {
+    const int section = mesh.Sections[triangles[i]];
+    if (section == SectionLeafCards || section == SectionLeafMeshes)
+    {
+      leafTriangles.push_back(triangles[i]);
+    }
+    else
+    {
+      // Strips are already spatially coherent
+      ordered.push_back(triangles[i]);
+    }
+  }
+  if (leafTriangles.empty() || mesh.LeafCenters.empty())
+  {
+    ordered.insert(ordered.end(), leafTriangles.begin(), leafTriangles.end());
+    return;
+  }
+
+  float lo[3] = {1e30f, 1e30f, 1e30f};
+  float hi[3] = {-1e30f, -1e30f, -1e30f};
+  for (size_t i = 0; i < leafTriangles.size(); ++i)
+  {
+    const float *c = &mesh.LeafCenters[mesh.Elements[leafTriangles[i]] * 3];
+    for (int k = 0; k < 3; ++k)
+    {
+      lo[k] = std::min(lo[k], c[k]);
+      hi[k] = std::max(hi[k], c[k]);
+    }
+  }
+
+  // Triangles of a leaf are adjacent, sort leaves and keep the triangle order inside a leaf
+  std::vector<MortonKey> keys;
+  std::vector<int> firstTriangle;
+  for (size_t i = 0; i < leafTriangles.size(); ++i)
+  {
+    const int element = mesh.Elements[leafTriangles[i]];
+    if (i && mesh.Elements[leafTriangles[i - 1]] == element)
+    {
+      continue;
+    }
+    const float *c = &mesh.LeafCenters[element * 3];
+    unsigned int code = 0;
+    for (int k = 0; k < 3; ++k)
+    {
+      const float extent = hi[k] - lo[k];
+      unsigned int q = extent > 0.f ? (unsigned int)((c[k] - lo[k]) / extent * 1023.f) : 0;
+      code |= ExpandBits(std::min(q, 1023u)) << (2 - k);
+    }
+    MortonKey key;
+    key.Code = code;
+    key.Element = (int)firstTriangle.size();
+    keys.push_back(key);
+    firstTriangle.push_back((int)i);
+  }
+  firstTriangle.push_back((int)leafTriangles.size());
+  std::sort(keys.begin(), keys.end());
+  for (size_t i = 0; i < keys.size(); ++i)
+  {
+    for (int t = firstTriangle[keys[i].Element]; t < firstTriangle[keys[i].Element + 1]; ++t)
+    {
+      ordered.push_back(leafTriangles[t]);
+    }
+  }
+}
+
+static void ComputeBounds(TreeMesh const &mesh, MeshletSet const &set, Meshlet &m)
+{
+  double lo[3] = {1e30, 1e30, 1e30};
+  double hi[3] = {-1e30, -1e30, -1e30};
+  for (unsigned int i = 0; i < m.VertexCount; ++i)
+  {
+    const double *p = &mesh.Positions[set.Vertices[m.VertexOffset + i] * 3];
+    for (int k = 0; k < 3; ++k)
+    {
+      lo[k] = std::min(lo[k], p[k]);
+      hi[k] = std::max(hi[k], p[k]);
+    }
+  }
+  double center[3] = {(lo[0] + hi[0]) * .5, (lo[1] + hi[1]) * .5, (lo[2] + hi[2]) * .5};
+  double radius = 0.;
+  for (unsigned int i = 0; i < m.VertexCount; ++i)
+  {
+    const double *p = &mesh.Positions[set.Vertices[m.VertexOffset + i] * 3];
+    const double d[3] = {p[0] - center[0], p[1] - center[1], p[2] - center[2]};
+    radius = std::max(radius, d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+  }
+  for (int k = 0; k < 3; ++k)
+  {
+    m.Center[k] = (float)center[k];
+  }
+  m.Radius = (float)std::sqrt(radius);
+
+  // Normal cone over the face normals
+  std::vector<double> normals;
+  std::vector<const double*> corners;
+  double axis[3] = {0., 0., 0.};
+  for (unsigned int t = 0; t < m.TriangleCount; ++t)
+  {
+    const unsigned char *local = &set.Triangles[(m.TriangleOffset + t) * 3];
+    const double *a = &mesh.Positions[set.Vertices[m.VertexOffset + local[0]] * 3];
+    const double *b = &mesh.Positions[set.Vertices[m.VertexOffset + local[1]] * 3];
+    const double *c = &mesh.Positions[set.Vertices[m.VertexOffset + local[2]] * 3];
+    const double e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    const double e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+    double n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+    const double len = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    if (len <= 0.)
+    {
+      continue;
+    }
+    for (int k = 0; k < 3; ++k)
+    {
+      n[k] /= len;
+      axis[k] += n[k];
+      normals.push_back(n[k]);
+    }
+    corners.push_back(a);
+  }
+
+  m.ConeAxis[0] = m.ConeAxis[1] = m.ConeAxis[2] = 0.f;
+  m.ConeApex[0] = m.Center[0];
+  m.ConeApex[1] = m.Center[1];
+  m.ConeApex[2] = m.Center[2];
+  m.ConeCutoff = 1.f;
+  const double axisLen = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+  if (normals.empty() || axisLen <= 0.)
+  {
+    return;
+  }
+  for (int k = 0; k < 3; ++k)
+  {
+    axis[k] /= axisLen;
+    m.ConeAxis[k] = (float)axis[k];
+  }
+  double minDot = 1.;
+  for (size_t i = 0; i < normals.size(); i += 3)
+  {
+    minDot = std::min(minDot, normals[i] * axis[0] + normals[i + 1] * axis[1] + normals[i + 2] * axis[2]);
+  }
+  if (minDot <= 0.1)
+  {
+    // Wider than ~84 degrees, there's no view direction that hides every triangle
+    return;
+  }
+
+  // Move the apex back along the axis until every triangle plane is in front of it
+  double maxT = 0.;
+  for (size_t t = 0; t < corners.size(); ++t)
+  {
+    const double *a = corners[t];
+    const double *nrm = &normals[t * 3];
+    const double dc = (center[0] - a[0]) * nrm[0] + (center[1] - a[1]) * nrm[1] + (center[2] - a[2]) * nrm[2];
+    const double dn = axis[0] * nrm[0] + axis[1] * nrm[1] + axis[2] * nrm[2];
+    maxT = std::max(maxT, dc / dn);
+  }
+  for (int k = 0; k < 3; ++k)
+  {
+    m.ConeApex[k] = (float)(center[k] - axis[k] * maxT);
+  }
+  m.ConeCutoff = (float)std::sqrt(1. - minDot * minDot);
+}
+
+void BuildMeshlets(TreeMesh const &mesh, unsigned int part, MeshletOptions const &options, MeshletSet &result)
+{
+  const int triangleCount = mesh.GetTriangleCount();
+  std::vector<std::vector<int> > byMaterial(mesh.MaterialNames.size());
+  for (int i = 0; i < triangleCount; ++i)
+  {
+    const int material = mesh.Materials[i];
+    if (material >= (int)byMaterial.size())
+    {
+      byMaterial.resize(material + 1);
+    }
+    byMaterial[material].push_back(i);
+  }
+
+  // Local index of a mesh vertex in the current meshlet, valid while stamp matches
+  std::vector<int> local(mesh.GetVertexCount(), 0);
+  std::vector<unsigned int> stamp(mesh.GetVertexCount(), 0);
+  unsigned int currentStamp = 0;
+  std::vector<int> ordered;
+
+  for (size_t material = 0; material < byMaterial.size(); ++material)
+  {
+    OrderTriangles(mesh, byMaterial[material], ordered);
+    Meshlet current;
+    memset(&current, 0, sizeof(current));
+    for (size_t i = 0; i < ordered.size(); ++i)
+    {
+      const int *tri = &mesh.Indices[ordered[i] * 3];
+      int added = 0;
+      for (int k = 0; k < 3; ++k)
+      {
+        // Degenerate strip triangles may repeat a vertex
+        const bool repeated = (k > 0 && tri[k] == tri[0]) || (k == 2 && tri[2] == tri[1]);
+        if (stamp[tri[k]] != currentStamp && !repeated)
+        {
+          added++;
+        }
+      }
+      if (current.TriangleCount && (current.VertexCount + added > (unsigned int)options.MaxVertices || current.TriangleCount + 1 > (unsigned int)options.MaxTriangles))
+      {
+        ComputeBounds(mesh, result, current);
+        result.Meshlets.push_back(current);
+        memset(&current, 0, sizeof(current));
+      }
+      if (!current.TriangleCount)
+      {
+        current.Material = (unsigned int)material;
+        current.Part = part;
+        current.VertexOffset = (unsigned int)result.Vertices.size();
+        current.TriangleOffset = (unsigned int)result.Triangles.size() / 3;
+        currentStamp++;
+      }
+      for (int k = 0; k < 3; ++k)
+      {
+        if (stamp[tri[k]] != currentStamp)
+        {
+          stamp[tri[k]] = currentStamp;
+          local[tri[k]] = (int)current.VertexCount++;
+          result.Vertices.push_back((unsigned int)tri[k]);
+        }
+        result.Triangles.push_back((unsigned char)local[tri[k]]);
+      }
+      current.TriangleCount++;
+    }
+    if (current.TriangleCount)
+    {
+      ComputeBounds(mesh, result, current);
+      result.Meshlets.push_back(current);
+    }
+  }
+}
+
+static void WriteU32(FILE *f, unsigned int v)
+{
+  const unsigned char bytes[4] = {(unsigned char)v, (unsigned char)(v >> 8), (unsigned char)(v >> 16), (unsigned char)(v >> 24)};
+  fwrite(bytes, 1, 4, f);
+}
+
+static void WriteF32(FILE *f, float v)
+{
+  unsigned int bits;
+  memcpy(&bits, &v, 4);
+  WriteU32(f, bits);
+}
+
+bool WriteMeshlets(FILE *f, MeshletSet const &meshlets, MeshletOptions const &options)
+{
+  fwrite("SPML", 1, 4, f);
+  WriteU32(f, MeshletFileVersion);
+  WriteU32(f, (unsigned int)meshlets.Meshlets.size());
+  WriteU32(f, (unsigned int)meshlets.Vertices.size());
+  WriteU32(f, (unsigned int)meshlets.Triangles.size() / 3);
+  WriteU32(f, (unsigned int)options.MaxVertices);
+  WriteU32(f, (unsigned int)options.MaxTriangles);
+  WriteU32(f, 0);
+  for (size_t i = 0; i < meshlets.Meshlets.size(); ++i)
+  {
+    Meshlet const &m = meshlets.Meshlets[i];
+    WriteU32(f, m.VertexOffset);
+    WriteU32(f, m.VertexCount);
+    WriteU32(f, m.TriangleOffset);
+    WriteU32(f, m.TriangleCount);
+    WriteU32(f, m.Material);
+    WriteU32(f, m.Part);
+    for (int k = 0; k < 3; ++k) WriteF32(f, m.Center[k]);
+    WriteF32(f, m.Radius);
+    for (int k = 0; k < 3; ++k) WriteF32(f, m.ConeApex[k]);
+    for (int k = 0; k < 3; ++k) WriteF32(f, m.ConeAxis[k]);
+    WriteF32(f, m.ConeCutoff);
+  }
+  for (size_t i = 0; i < meshlets.Vertices.size(); ++i)
+  {
+    WriteU32(f, meshlets.Vertices[i]);
+  }
+  if (!meshlets.Triangles.empty())
+  {
+    fwrite(&meshlets.Triangles[0], 1, meshlets.Triangles.size(), f);
+  }
+  const unsigned char padding[4] = {0, 0, 0, 0};
+  fwrite(padding, 1, (4 - meshlets.Triangles.size() % 4) % 4, f);
+  return ferror(f) == 0;
+}
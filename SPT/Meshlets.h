@@ -0,0 +1,60 @@
+#ifndef _MESHLETS_H
+#define _MESHLETS_H
+
+#include "TreeMesh.h"
+
+#include <cstdio>
+#include <vector>
+
+// Clusters for GPU-driven rendering. Every meshlet holds up to MaxVertices unique
+// vertices and MaxTriangles triangles of a single material.
+struct MeshletOptions
+{
+  MeshletOptions()
+  {
+    MaxVertices = 64;
+    MaxTriangles = 124;
+  }
+  int MaxVertices;  // 3..256, local indices are stored as bytes
+  int MaxTriangles; // 1..512
+};
+
+struct Meshlet
+{
+  unsigned int VertexOffset;   // into MeshletSet::Vertices
+  unsigned int VertexCount;
+  unsigned int TriangleOffset; // into MeshletSet::Triangles, in triangles
+  unsigned int TriangleCount;
+  unsigned int Material;       // material slot of the part's node
+  unsigned int Part;           // mesh node in output order, 0 unless foliage is split
+  float Center[3];
+  float Radius;
+  // Backface cone: the meshlet can be skipped if
+  // dot(normalize(ConeApex - cameraPosition), ConeAxis) >= ConeCutoff
+  float ConeApex[3];
+  float ConeAxis[3];
+  float ConeCutoff;            // 1 when the cone is too wide to cull anything
+};
+
+struct MeshletSet
+{
+  std::vector<Meshlet> Meshlets;
+  std::vector<unsigned int> Vertices;   // mesh vertex (control point) indices
+  std::vector<unsigned char> Triangles; // 3 local vertex indices per triangle
+};
+
+bool IsValid(MeshletOptions const &options);
+
+// Partitions every material group of the mesh and appends the meshlets to result.
+// Leaves are reordered along a Morton curve of their centers first, so that a meshlet
+// covers one compact patch of the crown.
+void BuildMeshlets(TreeMesh const &mesh, unsigned int part, MeshletOptions const &options, MeshletSet &result);
+
+// Little-endian sidecar layout (all fields 32 bit):
+//   char[4] "SPML", version, meshlet count, vertex count, triangle count, max vertices, max triangles, 0
+//   Meshlet records in declaration order (18 fields each)
+//   vertex indices
+//   triangles, 3 bytes each, padded with zeros to a multiple of 4 bytes
+bool WriteMeshlets(FILE *f, MeshletSet const &meshlets, MeshletOptions const &options);
+
+#endif // #ifndef _MESHLETS_H
@@ -0,0 +1,239 @@
+#include "Partition.h"
+
+#include <algorithm>
+#include <cstdio>
+
+struct ClusterPoint
+{
+  double P[3];
+  int Id;
+};
+
+struct AlongAxis
+{
+  AlongAxis(int axis)
+    : Axis(axis)
+  {
+  }
+  bool operator()(ClusterPoint const &a, ClusterPoint const &b) const
+  {
+    return a.P[Axis] != b.P[Axis] ? a.P[Axis] < b.P[Axis] : a.Id < b.Id;
+  }
+  int Axis;
+};
+
+// Median splits along the longest axis of the cell until every cell holds at most target
+// points. Unlike an octree split, clusters end up between target / 2 and target points.
+static void Subdivide(std::vector<ClusterPoint> &points, size_t begin, size_t end, size_t target, std::vector<std::vector<int> > &clusters)
+{
+  if (end - begin <= target)
+  {
+    clusters.push_back(std::vector<int>());
+    for (size_t i = begin; i < end; ++i)
+    {
+      clusters.back().push_back(points[i].Id);
+    }
+    return;
+  }
+
+  double lo[3] = {points[begin].P[0], points[begin].P[1], points[begin].P[2]};
+  double hi[3] = {lo[0], lo[1], lo[2]};
+  for (size_t i = begin; i < end; ++i)
+  {
+    for (int k = 0; k < 3; ++k)
+    {
+      lo[k] = std::min(lo[k], points[i].P[k]);
+      hi[k] = std::max(hi[k], points[i].P[k]);
+    }
+  }
+  int axis = 0;
+  for (int k = 1; k < 3; ++k)
+  {
+    if (hi[k] - lo[k] > hi[axis] - lo[axis])
+    {
+      axis = k;
+    }
+  }
+  // Split into a multiple of the target size so the cells fill up evenly
+  const size_t cells = (end - begin + target - 1) / target;
+  const size_t mid = begin + (cells / 2) * ((end - begin) / cells) + std::min(cells / 2, (end - begin) % cells);
+  std::nth_element(points.begin() + begin, points.begin() + mid, points.begin() + end, AlongAxis(axis));
+  Subdivide(points, begin, mid, target, clusters);
+  Subdivide(points, mid, end, target, clusters);
+}
+
+// Channels that aren't exported are empty and stay empty
+template<typename T>
+inline void CopyVertex(std::vector<T> const &src, int v, int size, std::vector<T> &dst)
+{
+  if (!src.empty())
+  {
+    dst.insert(dst.end(), &src[v * size], &src[v * size] + size);
+  }
+}
+
+static void CopyTriangles(TreeMesh const &src, std::vector<int> const &triangles, bool allMaterials, MeshPart &part)
+{
+  TreeMesh &dst = part.Mesh;
+  dst.Attributes = src.Attributes;
+  std::vector<int> vertexRemap(src.GetVertexCount(), -1);
+  std::vector<int> materialRemap(src.MaterialNames.size(), -1);
+  std::vector<int> leafRemap(src.LeafCenters.size() / 3, -1);
+  if (allMaterials)
+  {
+    for (size_t i = 0; i < src.MaterialNames.size(); ++i)
+    {
+      materialRemap[i] = (int)i;
+      part.MaterialIds.push_back((int)i);
+      dst.MaterialNames.push_back(src.MaterialNames[i]);
+    }
+  }
+
+  for (size_t t = 0; t < triangles.size(); ++t)
+  {
+    const int tri = triangles[t];
+    const int material = src.Materials[tri];
+    if (materialRemap[material] == -1)
+    {
+      materialRemap[material] = (int)dst.MaterialNames.size();
+      part.MaterialIds.push_back(material);
+      dst.MaterialNames.push_back(src.MaterialNames[material]);
+    }
+    int element = src.Elements[tri];
+    if (src.Sections[tri] == SectionLeafCards || src.Sections[tri] == SectionLeafMeshes)
+    {
+      if (leafRemap[element] == -1)
+      {
+        leafRemap[element] = (int)dst.LeafCenters.size() / 3;
+        dst.LeafCenters.insert(dst.LeafCenters.end(), &src.LeafCenters[element * 3], &src.LeafCenters[element * 3] + 3);
+      }
+      element = leafRemap[element];
+    }
+
+    for (int k = 0; k < 3; ++k)
+    {
+      const int v = src.Indices[tri * 3 + k];
+      if (vertexRemap[v] == -1)
+      {
+        vertexRemap[v] = dst.GetVertexCount();
+        CopyVertex(src.Positions, v, 3, dst.Positions);
+        CopyVertex(src.Normals, v, 3, dst.Normals);
+        CopyVertex(src.Binormals, v, 3, dst.Binormals);
+        CopyVertex(src.Tangents, v, 3, dst.Tangents);
+        CopyVertex(src.Colors, v, 4, dst.Colors);
+        for (int uv = 0; uv < UVSetCount; ++uv)
+        {
+          CopyVertex(src.UVs[uv], v, 2, dst.UVs[uv]);
+        }
+        CopyVertex(src.Wind, v, 4, dst.Wind);
+      }
+      dst.Indices.push_back(vertexRemap[v]);
+    }
+    dst.Materials.push_back(materialRemap[material]);
+    dst.Groups.push_back(src.Groups[tri]);
+    dst.Elements.push_back(element);
+    dst.Sections.push_back(src.Sections[tri]);
+  }
+
+  for (int k = 0; k < 3; ++k)
+  {
+    part.BoundsMin[k] = dst.Positions.empty() ? 0. : dst.Positions[k];
+    part.BoundsMax[k] = part.BoundsMin[k];
+  }
+  for (size_t i = 0; i < dst.Positions.size(); i += 3)
+  {
+    for (int k = 0; k < 3; ++k)
+    {
+      part.BoundsMin[k] = std::min(part.BoundsMin[k], dst.Positions[i + k]);
+      part.BoundsMax[k] = std::max(part.BoundsMax[k], dst.Positions[i + k]);
+    }
+  }
+}
+
+static void AddClusters(TreeMesh const &mesh, std::vector<std::vector<int> > const &clusters, const char *name, std::vector<MeshPart> &parts)
+{
+  for (size_t i = 0; i < clusters.size(); ++i)
+  {
+    char suffix[64];
+    sprintf(suffix, "_%s_%02u", name, (unsigned)i);
+    parts.push_back(MeshPart());
+    parts.back().Suffix = suffix;
+    CopyTriangles(mesh, clusters[i], false, parts.back());
+  }
+}
+
+void PartitionMesh(TreeMesh const &mesh, PartitionOptions const &options, std::vector<MeshPart> &parts)
+{
+  parts.clear();
+  const int triangleCount = mesh.GetTriangleCount();
+  std::vector<int> rest;
+  std::vector<ClusterPoint> leaves;
+  std::vector<ClusterPoint> fronds;
+  std::vector<std::vector<int> > leafTriangles(mesh.LeafCenters.size() / 3);
+  for (int tri = 0; tri < triangleCount; ++tri)
+  {
+    const int section = mesh.Sections[tri];
+    if (options.Leaves && (section == SectionLeafCards || section == SectionLeafMeshes))
+    {
+      const int leaf = mesh.Elements[tri];
+      if (leafTriangles[leaf].empty())
+      {
+        ClusterPoint p;
+        p.P[0] = mesh.LeafCenters[leaf * 3];
+        p.P[1] = mesh.LeafCenters[leaf * 3 + 1];
+        p.P[2] = mesh.LeafCenters[leaf * 3 + 2];
+        p.Id = leaf;
+        leaves.push_back(p);
+      }
+      leafTriangles[leaf].push_back(tri);
+    }
+    else if (options.Fronds && section == SectionFronds)
+    {
+      ClusterPoint p;
+      for (int k = 0; k < 3; ++k)
+      {
+        p.P[k] = (mesh.Positions[mesh.Indices[tri * 3] * 3 + k] + mesh.Positions[mesh.Indices[tri * 3 + 1] * 3 + k] + mesh.Positions[mesh.Indices[tri * 3 + 2] * 3 + k]) / 3.;
+      }
+      p.Id = tri;
+      fronds.push_back(p);
+    }
+    else
+    {
+      rest.push_back(tri);
+    }
+  }
+
+  parts.push_back(MeshPart());
+  CopyTriangles(mesh, rest, true, parts.back());
+
+  if (!leaves.empty())
+  {
+    std::vector<std::vector<int> > clusters;
+    Subdivide(leaves, 0, leaves.size(), std::max(options.LeavesPerCluster, 1), clusters);
+    // Expand leaves to their triangles, keeping the source order inside a cluster
+    for (size_t i = 0; i < clusters.size(); ++i)
+    {
+      std::vector<int> triangles;
+      std::sort(clusters[i].begin(), clusters[i].end());
+      for (size_t l = 0; l < clusters[i].size(); ++l)
+      {
+        std::vector<int> const &t = leafTriangles[clusters[i][l]];
+        triangles.insert(triangles.end(), t.begin(), t.end());
+      }
+      std::sort(triangles.begin(), triangles.end());
+      clusters[i].swap(triangles);
+    }
+    AddClusters(mesh, clusters, "leaves", parts);
+  }
+
+  if (!fronds.empty())
+  {
+    std::vector<std::vector<int> > clusters;
+    Subdivide(fronds, 0, fronds.size(), std::max(options.FrondTrianglesPerCluster, 1), clusters);
+    for (size_t i = 0; i < clusters.size(); ++i)
+    {
+      std::sort(clusters[i].begin(), clusters[i].end());
+    }
+    AddClusters(mesh, clusters, "fronds", parts);
+  }
+}
@@ -0,0 +1,38 @@
+#ifndef _PARTITION_H
+#define _PARTITION_H
+
+#include "TreeMesh.h"
+
+#include <string>
+#include <vector>
+
+// Splits foliage into spatial clusters so that engines can cull and stream parts of a tree
+struct PartitionOptions
+{
+  PartitionOptions()
+  {
+    Leaves = false;
+    Fronds = false;
+    LeavesPerCluster = 256;
+    FrondTrianglesPerCluster = 2048;
+  }
+  bool Leaves;                  // Cluster leaf cards and leaf meshes by leaf center
+  bool Fronds;                  // Cluster frond triangles by centroid
+  int LeavesPerCluster;
+  int FrondTrianglesPerCluster;
+};
+
+struct MeshPart
+{
+  std::string Suffix;            // Appended to the node name, empty for the main part
+  TreeMesh Mesh;                 // Material indices are local to the part
+  std::vector<int> MaterialIds;  // Local material index -> index in the source mesh
+  double BoundsMin[3];
+  double BoundsMax[3];
+};
+
+// The first part holds everything that isn't clustered (and keeps every material of
+// the source mesh), followed by "_leaves_NN" and "_fronds_NN" clusters.
+void PartitionMesh(TreeMesh const &mesh, PartitionOptions const &options, std::vector<MeshPart> &parts);
+
+#endif // #ifndef _PARTITION_H
@@ -0,0 +1,406 @@
+#include "Report.h"
+#include "Common.h"
+#include "Json.h"
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <set>
+
+Manifest::Manifest()
+  : File(NULL)
+{
+}
+
+Manifest::~Manifest()
+{
+  Close();
+}
+
+bool Manifest::Open(std::wstring const &path)
+{
+  Close();
+  return _wfopen_s(&File, path.c_str(), L"wb") == 0 && File;
+}
+
+void Manifest::AddLine(std::string const &line)
+{
+  if (File)
+  {
+    fwrite(line.c_str(), 1, line.size(), File);
+    fputc('\n', File);
+    fflush(File);
+  }
+}
+
+void Manifest::Close()
+{
+  if (File)
+  {
+    fclose(File);
+    File = NULL;
+  }
+}
+
+std::string FormatSize(unsigned long long bytes)
+{
+  const char *units[] = {"B", "KB", "MB", "GB", "TB"};
+  double size = (double)bytes;
+  int unit = 0;
+  while (size >= 1024. && unit < 4)
+  {
+    size /= 1024.;
+    unit++;
+  }
+  char buf[32];
+  sprintf(buf, unit ? "%.1f %s" : "%.0f %s", size, units[unit]);
+  return buf;
+}
+
+std::string FormatStats(MeshStats const &stats)
+{
+  char buf[256];
+  sprintf(buf, "%d degenerate, %d duplicate triangles, %d unreferenced vertices, leaf area %.1f, overdraw %.2f, %.1f triangles/unit^2",
+    stats.DegenerateTriangles, stats.DuplicateTriangles, stats.UnreferencedVertices, stats.LeafArea, stats.LeafOverdraw, stats.TriangleDensity);
+  return buf;
+}
+
+std::string FormatShardRecord(ShardSpec const &spec, size_t discovered, size_t assigned, int failed, double totalMs)
+{
+  JsonWriter w;
+  w.BeginObject();
+  w.Key("type");
+  w.String("shard");
+  w.Key("index");
+  w.Int(spec.Index + 1);
+  w.Key("count");
+  w.Int(spec.Count);
+  w.Key("balance");
+  w.String(spec.BalanceBySize ? "size" : "hash");
+  w.Key("discovered");
+  w.Int((long long)discovered);
+  w.Key("assigned");
+  w.Int((long long)assigned);
+  w.Key("failed");
+  w.Int(failed);
+  w.Key("total_ms");
+  w.Number(totalMs);
+  w.EndObject();
+  return w.Str();
+}
+
+struct TreeRecord
+{
+  std::string Id;
+  std::string Error;
+  std::vector<std::string> Warnings;
+  double TotalMs;
+};
+
+// Output size and time of the trees exported with one attribute set
+struct AttributeStats
+{
+  AttributeStats()
+  {
+    Trees = 0;
+    Bytes = 0;
+    TotalMs = 0.;
+  }
+  int Trees;
+  long long Bytes;
+  double TotalMs;
+};
+
+static bool SlowerFirst(TreeRecord const &a, TreeRecord const &b)
+{
+  return a.TotalMs > b.TotalMs;
+}
+
+int MergeManifests(std::wstring const &summaryPath, std::vector<std::wstring> const &manifests)
+{
+  int expectedShards = 0;
+  std::set<int> shards;
+  std::map<std::string, int> seen;
+  std::vector<TreeRecord> trees;
+  std::vector<std::string> failures;
+  int ok = 0;
+  int warned = 0;
+  long long vertices = 0;
+  long long triangles = 0;
+  long long welded = 0;
+  long long bytes = 0;
+  std::map<std::string, AttributeStats> attributes;
+  double loadMs = 0., computeMs = 0., generateMs = 0., saveMs = 0.;
+  double slowestShardMs = 0.;
+  bool consistent = true;
+
+  for (size_t m = 0; m < manifests.size(); ++m)
+  {
+    FILE *f = NULL;
+    if (_wfopen_s(&f, manifests[m].c_str(), L"rb"))
+    {
+      std::cerr << "Failed to open: " << w2a(manifests[m]) << std::endl;
+      return EXIT_FAILURE;
+    }
+    std::string line;
+    char buf[4096];
+    while (fgets(buf, sizeof(buf), f))
+    {
+      line += buf;
+      if (line[line.size() - 1] != '\n' && !feof(f))
+      {
+        continue;
+      }
+      JsonValue value;
+      std::string error;
+      if (line.find_first_not_of(" \t\r\n") == std::string::npos)
+      {
+        line.clear();
+        continue;
+      }
+      if (!ParseJson(line, value, error))
+      {
+        std::cerr << w2a(manifests[m]) << ": " << error << std::endl;
+        line.clear();
+        consistent = false;
+        continue;
+      }
+      line.clear();
+
+      if (value.GetString("type") == "shard")
+      {
+        const int count = (int)value.GetNumber("count");
+        if (expectedShards && count != expectedShards)
+        {
+          std::cerr << w2a(manifests[m]) << ": shard count " << count << " doesn't match " << expectedShards << std::endl;
+          consistent = false;
+        }
+        expectedShards = std::max(expectedShards, count);
+        if (!shards.insert((int)value.GetNumber("index")).second)
+        {
+          std::cerr << w2a(manifests[m]) << ": shard " << (int)value.GetNumber("index") << " listed twice" << std::endl;
+          consistent = false;
+        }
+        slowestShardMs = std::max(slowestShardMs, value.GetNumber("total_ms"));
+        continue;
+      }
+
+      TreeRecord tree;
+      tree.Id = value.GetString("id");
+      tree.TotalMs = 0.;
+      if (seen[tree.Id]++)
+      {
+        continue;
+      }
+      if (const JsonValue *timings = value.Find("timings"))
+      {
+        tree.TotalMs = timings->GetNumber("total_ms");
+        loadMs += timings->GetNumber("load_ms");
+        computeMs += timings->GetNumber("compute_ms");
+        generateMs += timings->GetNumber("generate_ms");
+        saveMs += timings->GetNumber("save_ms");
+      }
+      if (value.GetString("status") == "ok")
+      {
+        ok++;
+        if (const JsonValue *counts = value.Find("counts"))
+        {
+          vertices += (long long)counts->GetNumber("vertices");
+          triangles += (long long)counts->GetNumber("triangles");
+          welded += (long long)counts->GetNumber("welded_vertices");
+        }
+        AttributeStats &stats = attributes[value.GetString("attributes", "full")];
+        stats.Trees++;
+        stats.Bytes += (long long)value.GetNumber("output_bytes");
+        stats.TotalMs += tree.TotalMs;
+        bytes += (long long)value.GetNumber("output_bytes");
+        if (const JsonValue *warnings = value.Find("warnings"))
+        {
+          for (size_t i = 0; warnings->IsArray() && i < warnings->Size(); ++i)
+          {
+            tree.Warnings.push_back((*warnings)[i].AsString());
+          }
+          warned += !tree.Warnings.empty();
+        }
+      }
+      else
+      {
+        tree.Error = value.GetString("error");
+        failures.push_back(tree.Id);
+      }
+      trees.push_back(tree);
+    }
+    fclose(f);
+  }
+
+  std::vector<std::string> duplicates;
+  for (std::map<std::string, int>::const_iterator it = seen.begin(); it != seen.end(); ++it)
+  {
+    if (it->second > 1)
+    {
+      duplicates.push_back(it->first);
+    }
+  }
+  std::vector<int> missing;
+  for (int i = 1; i <= expectedShards; ++i)
+  {
+    if (!shards.count(i))
+    {
+      missing.push_back(i);
+    }
+  }
+
+  double totalMs = 0.;
+  for (size_t i = 0; i < trees.size(); ++i)
+  {
+    totalMs += trees[i].TotalMs;
+  }
+  std::sort(trees.begin(), trees.end(), SlowerFirst);
+
+  JsonWriter w;
+  w.BeginObject();
+  w.Key("shards");
+  w.BeginObject();
+  w.Key("expected");
+  w.Int(expectedShards);
+  w.Key("found");
+  w.Int((long long)shards.size());
+  w.Key("missing");
+  w.BeginArray();
+  for (size_t i = 0; i < missing.size(); ++i)
+  {
+    w.Int(missing[i]);
+  }
+  w.EndArray();
+  w.Key("slowest_ms");
+  w.Number(slowestShardMs);
+  w.EndObject();
+  w.Key("trees");
+  w.BeginObject();
+  w.Key("total");
+  w.Int((long long)trees.size());
+  w.Key("ok");
+  w.Int(ok);
+  w.Key("failed");
+  w.Int((long long)failures.size());
+  w.EndObject();
+  w.Key("counts");
+  w.BeginObject();
+  w.Key("vertices");
+  w.Int(vertices);
+  w.Key("triangles");
+  w.Int(triangles);
+  w.Key("welded_vertices");
+  w.Int(welded);
+  w.Key("output_bytes");
+  w.Int(bytes);
+  w.EndObject();
+  w.Key("attributes");
+  w.BeginArray();
+  for (std::map<std::string, AttributeStats>::const_iterator it = attributes.begin(); it != attributes.end(); ++it)
+  {
+    w.BeginObject();
+    w.Key("name");
+    w.String(it->first);
+    w.Key("trees");
+    w.Int(it->second.Trees);
+    w.Key("output_bytes");
+    w.Int(it->second.Bytes);
+    w.Key("total_ms");
+    w.Number(it->second.TotalMs);
+    w.EndObject();
+  }
+  w.EndArray();
+  w.Key("timings");
+  w.BeginObject();
+  w.Key("load_ms");
+  w.Number(loadMs);
+  w.Key("compute_ms");
+  w.Number(computeMs);
+  w.Key("generate_ms");
+  w.Number(generateMs);
+  w.Key("save_ms");
+  w.Number(saveMs);
+  w.Key("total_ms");
+  w.Number(totalMs);
+  w.EndObject();
+  w.Key("failures");
+  w.BeginArray();
+  for (size_t i = 0; i < trees.size(); ++i)
+  {
+    if (!trees[i].Error.empty())
+    {
+      w.BeginObject();
+      w.Key("id");
+      w.String(trees[i].Id);
+      w.Key("error");
+      w.String(trees[i].Error);
+      w.EndObject();
+    }
+  }
+  w.EndArray();
+  w.Key("warnings");
+  w.BeginArray();
+  for (size_t i = 0; i < trees.size(); ++i)
+  {
+    for (size_t j = 0; j < trees[i].Warnings.size(); ++j)
+    {
+      w.BeginObject();
+      w.Key("id");
+      w.String(trees[i].Id);
+      w.Key("warning");
+      w.String(trees[i].Warnings[j]);
+      w.EndObject();
+    }
+  }
+  w.EndArray();
+  w.Key("duplicates");
+  w.BeginArray();
+  for (size_t i = 0; i < duplicates.size(); ++i)
+  {
+    w.String(duplicates[i]);
+  }
+  w.EndArray();
+  w.Key("slowest");
+  w.BeginArray();
+  for (size_t i = 0; i < trees.size() && i < 10; ++i)
+  {
+    w.BeginObject();
+    w.Key("id");
+    w.String(trees[i].Id);
+    w.Key("total_ms");
+    w.Number(trees[i].TotalMs);
+    w.EndObject();
+  }
+  w.EndArray();
+  w.EndObject();
+
+  Manifest summary;
+  if (!summary.Open(summaryPath))
+  {
+    std::cerr << "Failed to write: " << w2a(summaryPath) << std::endl;
+    return EXIT_FAILURE;
+  }
+  summary.AddLine(w.Str());
+  summary.Close();
+
+  std::cout << "Merged " << manifests.size() << " manifests: " << trees.size() << " trees, " << ok << " ok, " << failures.size() << " failed";
+  if (warned)
+  {
+    std::cout << ", " << warned << " with warnings";
+  }
+  if (!missing.empty())
+  {
+    std::cout << ", " << missing.size() << " shards missing";
+  }
+  if (!duplicates.empty())
+  {
+    std::cout << ", " << duplicates.size() << " trees converted more than once";
+  }
+  std::cout << std::endl;
+  for (std::map<std::string, AttributeStats>::const_iterator it = attributes.begin(); it != attributes.end(); ++it)
+  {
+    std::cout << "  " << it->first << ": " << it->second.Trees << " trees, " << FormatSize(it->second.Bytes) << ", " << (long long)it->second.TotalMs << " ms" << std::endl;
+  }
+  return (consistent && failures.empty() && missing.empty() && duplicates.empty()) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,42 @@
+#ifndef _REPORT_H
+#define _REPORT_H
+
+#include "Shard.h"
+#include "Validation.h"
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Per-run manifest: one JSON result line per tree (the batch protocol format),
+// followed by a {"type": "shard", ...} record describing the run.
+class Manifest
+{
+public:
+  Manifest();
+  ~Manifest();
+
+  bool Open(std::wstring const &path);
+  bool IsOpen() const { return File != NULL; }
+  void AddLine(std::string const &line);
+  void Close();
+
+private:
+  Manifest(Manifest const&);
+  Manifest &operator=(Manifest const&);
+  FILE *File;
+};
+
+// Human readable file size, e.g. "1.5 MB"
+std::string FormatSize(unsigned long long bytes);
+
+// One line summary of the validation counters and statistics
+std::string FormatStats(MeshStats const &stats);
+
+std::string FormatShardRecord(ShardSpec const &spec, size_t discovered, size_t assigned, int failed, double totalMs);
+
+// Combines per-shard manifests into a single run summary written to summaryPath.
+// Fails if any tree failed, a shard is missing or a tree was converted by more than one shard.
+int MergeManifests(std::wstring const &summaryPath, std::vector<std::wstring> const &manifests);
+
+#endif // #ifndef _REPORT_H
@@ -6,9 +6,18 @@
 #include <vector>
 #include <iostream>
 #include <tchar.h>
+#include <algorithm>
+#include <cstdio>
+#include <cwctype>
+#include <io.h>
 
 #include "Export.h"
 #include "Common.h"
+#include "GeometryCache.h"
+#include "Job.h"
+#include "Report.h"
+#include "Server.h"
+#include "Shard.h"
 
 bool IsSptFile(std::wstring const &fullString) 
 {
@@ -23,7 +32,8 @@ bool IsSptFile(std::wstring const &fullString)
   }
 }
 
-void ParseDir(std::wstring name, std::vector<std::wstring> &result)
+// Collects .spt files, or .sptc geometry caches when caches is set
+void ParseDir(std::wstring name, std::vector<std::wstring> &result, bool caches)
 {
   _WDIR *dir;
   struct _wdirent *entry;
@@ -43,13 +53,13 @@ void ParseDir(std::wstring name, std::vector<std::wstring> &result)
       {
         continue;
       }
-      ParseDir(path, result);
+      ParseDir(path, result, caches);
     }
     else if (_tcsicmp(entry->d_name, L".") == 0)
     {
       continue;
     }
-    else if (entry->d_type == DT_REG && IsSptFile(path))
+    else if (entry->d_type == DT_REG && (caches ? IsGeometryCachePath(path) : IsSptFile(path)))
     {
       result.push_back(path);
     }
@@ -57,93 +67,371 @@ void ParseDir(std::wstring name, std::vector<std::wstring> &result)
   _wclosedir(dir);
 }
 
-bool ProcessTree(std::wstring const &sptFilePath)
+// Keys are the 1-based number of the input argument plus the path below it (the file name
+// for a file argument). They don't depend on where a node mounts the share, and equal
+// file names under different inputs stay apart.
+void AddSources(int input, std::wstring const &root, std::vector<std::wstring> const &paths, std::vector<SourceFile> &sources)
 {
+  char prefix[16];
+  sprintf(prefix, "%d/", input);
+  for (size_t i = 0; i < paths.size(); ++i)
+  {
+    SourceFile file;
+    file.Path = paths[i];
+    file.Key = MakeShardKey(a2w(prefix) + (root.empty() ? paths[i].substr(paths[i].find_last_of(L"\\/") + 1) : paths[i].substr(root.size() + 1)));
+    file.Size = FileSize(paths[i]);
+    sources.push_back(file);
+  }
+}
+
+void PrintUsage()
+{
+  std::cout << "Usage: Spt2Fbx [options] [file.spt | file.sptc | directory]..." << std::endl
+    << "  --format <name>          fbx (default), fbx-ascii, fbx6, obj, dae, dxf" << std::endl
+    << "  --lod <n>                LOD to export (default 0)" << std::endl
+    << "  --sections <list>        Export only some of branches, fronds, leaves, leaf-cards, leaf-meshes" << std::endl
+    << "  --attrs <list|preset>    Vertex channels: pos,normal,binormal,tangent,color,uv0..uv4" << std::endl
+    << "                           or full (default), unreal, unity, static, minimal" << std::endl
+    << "  --wind                   Add wind weights and matrix indices as two extra UV sets" << std::endl
+    << "  --meshlets               Write a .meshlets sidecar with GPU culling clusters" << std::endl
+    << "  --meshlet-limits <v>/<t> Max vertices/triangles per meshlet (default 64/124)" << std::endl
+    << "  --split-leaves [n]       Export leaves as spatial clusters of ~n leaves (default 256)" << std::endl
+    << "  --split-fronds [n]       Export fronds as spatial clusters of ~n triangles (default 2048)" << std::endl
+    << "  --weld [epsilon]         Merge vertices of a material that match within epsilon (default 0: exact)" << std::endl
+    << "  --cache                  Also write the computed geometry to a .sptc cache" << std::endl
+    << "  --from-cache             Export the .sptc caches found in directories instead of SPTs" << std::endl
+    << "  --threads <n>            Threads for extracting a large tree (default: one per CPU)" << std::endl
+    << "  --validate               Check the output mesh and print geometry statistics" << std::endl
+    << "  --max-triangles <n>      Budget per tree, also --max-vertices <n> and --max-bytes <n>" << std::endl
+    << "  --budget <warn|fail>     Warn about (default) or fail trees over budget or with invalid geometry" << std::endl
+    << "  --no-pause               Don't wait for a key press when finished" << std::endl
+    << "  --shard <i>/<n>          Convert only the i-th of n disjoint slices of the discovered files" << std::endl
+    << "  --shard-by <hash|size>   Slice by path hash (default) or balance slices by file size" << std::endl
+    << "  --manifest <file>        Write a JSON line per tree and a shard record to a file" << std::endl
+    << "  --merge <out> <file>...  Combine shard manifests into a run summary" << std::endl
+    << "  --serve                  Batch mode: read JSON jobs from stdin, write results to stdout" << std::endl
+    << "  --pipe <name>            With --serve: listen on a named pipe instead of stdin" << std::endl
+    << "  --jobs <n>               With --serve: number of worker threads (default: one per CPU)" << std::endl
+    << "  --submit <pipe> <file>   Send the jobs in a file to a running server and print the results" << std::endl;
+}
 
-  FILE *f = NULL;
-  if (_wfopen_s(&f, sptFilePath.c_str(), L"rb"))
+void Pause(bool interactive)
+{
+  if (interactive)
   {
-    std::cerr << "Failed to open: " << w2a(sptFilePath).c_str() << std::endl;
-    return false;
+    std::system("pause");
   }
-  fseek(f, 0, SEEK_END);
-  long size = ftell(f);
-  if (!size)
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+  std::vector<SourceFile> sources;
+  std::vector<std::wstring> inputs;
+  ExportOptions options;
+  ShardSpec shard;
+  std::wstring manifestPath;
+  ServerOptions serverOptions;
+  bool serve = false;
+  bool fromCache = false;
+  bool wind = false;
+  // Unattended runs (redirected stdin) never block on a key press
+  bool interactive = _isatty(_fileno(stdin)) != 0;
+  for (int idx = 1; idx < argc; ++idx)
   {
-    std::cerr << "File corrupted: " << w2a(sptFilePath).c_str() << std::endl;
-    fclose(f);
-    return false;
+    std::wstring arg(argv[idx]);
+    const bool hasValue = idx + 1 < argc;
+    if (arg == L"--format" && hasValue)
+    {
+      options.Format = w2a(argv[++idx]);
+      if (!FormatExtension(options.Format))
+      {
+        std::cerr << "Unknown format: " << options.Format << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+    else if (arg == L"--lod" && hasValue)
+    {
+      options.Lod = _wtoi(argv[++idx]);
+      if (options.Lod < 0)
+      {
+        std::cerr << "Invalid lod: " << w2a(argv[idx]) << std::endl;
+        PrintUsage();
+        return EXIT_FAILURE;
+      }
+    }
+    else if (arg == L"--sections" && hasValue)
+    {
+      if (!ParseSections(w2a(argv[++idx]), options.Sections))
+      {
+        std::cerr << "Invalid sections: " << w2a(argv[idx]) << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+    else if (arg == L"--attrs" && hasValue)
+    {
+      if (!ParseAttributes(w2a(argv[++idx]), options.Attributes))
+      {
+        std::cerr << "Invalid attributes: " << w2a(argv[idx]) << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+    else if (arg == L"--wind")
+    {
+      wind = true;
+    }
+    else if (arg == L"--meshlets")
+    {
+      options.Meshlets = true;
+    }
+    else if (arg == L"--meshlet-limits" && hasValue)
+    {
+      std::wstring limits(argv[++idx]);
+      size_t slash = limits.find(L'/');
+      options.MeshletLimits.MaxVertices = _wtoi(limits.substr(0, slash).c_str());
+      options.MeshletLimits.MaxTriangles = slash == std::wstring::npos ? 0 : _wtoi(limits.substr(slash + 1).c_str());
+      if (!IsValid(options.MeshletLimits))
+      {
+        std::cerr << "Invalid meshlet limits, expected <vertices>/<triangles> up to 256/512: " << w2a(limits) << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+    else if (arg == L"--split-leaves")
+    {
+      options.Partition.Leaves = true;
+      if (hasValue && iswdigit(argv[idx + 1][0]))
+      {
+        options.Partition.LeavesPerCluster = std::max(_wtoi(argv[++idx]), 1);
+      }
+    }
+    else if (arg == L"--split-fronds")
+    {
+      options.Partition.Fronds = true;
+      if (hasValue && iswdigit(argv[idx + 1][0]))
+      {
+        options.Partition.FrondTrianglesPerCluster = std::max(_wtoi(argv[++idx]), 1);
+      }
+    }
+    else if (arg == L"--weld")
+    {
+      options.Weld = true;
+      if (hasValue && (iswdigit(argv[idx + 1][0]) || argv[idx + 1][0] == L'.'))
+      {
+        options.WeldEpsilon = std::max(_wtof(argv[++idx]), 0.);
+      }
+    }
+    else if (arg == L"--cache")
+    {
+      options.Cache = true;
+    }
+    else if (arg == L"--from-cache")
+    {
+      fromCache = true;
+    }
+    else if (arg == L"--threads" && hasValue)
+    {
+      options.Threads = std::max(_wtoi(argv[++idx]), 0);
+    }
+    else if (arg == L"--validate")
+    {
+      options.Validate = true;
+    }
+    else if (arg == L"--max-triangles" && hasValue)
+    {
+      options.Budget.MaxTriangles = std::max(_wtoi(argv[++idx]), 0);
+    }
+    else if (arg == L"--max-vertices" && hasValue)
+    {
+      options.Budget.MaxVertices = std::max(_wtoi(argv[++idx]), 0);
+    }
+    else if (arg == L"--max-bytes" && hasValue)
+    {
+      options.Budget.MaxBytes = (unsigned long long)std::max(_wtoi64(argv[++idx]), 0LL);
+    }
+    else if (arg == L"--budget" && hasValue)
+    {
+      std::wstring mode(argv[++idx]);
+      if (mode != L"warn" && mode != L"fail")
+      {
+        std::cerr << "Unknown budget mode: " << w2a(mode) << std::endl;
+        return EXIT_FAILURE;
+      }
+      options.Budget.Fail = mode == L"fail";
+    }
+    else if (arg == L"--no-pause")
+    {
+      interactive = false;
+    }
+    else if (arg == L"--shard" && hasValue)
+    {
+      if (!ParseShardSpec(argv[++idx], shard))
+      {
+        std::cerr << "Invalid shard, expected <i>/<n>: " << w2a(argv[idx]) << std::endl;
+        return EXIT_FAILURE;
+      }
+    }
+    else if (arg == L"--shard-by" && hasValue)
+    {
+      std::wstring mode(argv[++idx]);
+      if (mode != L"hash" && mode != L"size")
+      {
+        std::cerr << "Unknown shard mode: " << w2a(mode) << std::endl;
+        return EXIT_FAILURE;
+      }
+      shard.BalanceBySize = mode == L"size";
+    }
+    else if (arg == L"--manifest" && hasValue)
+    {
+      manifestPath = argv[++idx];
+    }
+    else if (arg == L"--merge" && idx + 2 < argc)
+    {
+      std::vector<std::wstring> manifests(argv + idx + 2, argv + argc);
+      return MergeManifests(argv[idx + 1], manifests);
+    }
+    else if (arg == L"--serve")
+    {
+      serve = true;
+    }
+    else if (arg == L"--pipe" && hasValue)
+    {
+      serverOptions.PipeName = argv[++idx];
+    }
+    else if (arg == L"--jobs" && hasValue)
+    {
+      serverOptions.Workers = _wtoi(argv[++idx]);
+    }
+    else if (arg == L"--submit" && idx + 2 < argc)
+    {
+      std::wstring pipeName(argv[idx + 1]);
+      return RunClient(pipeName, argv[idx + 2]);
+    }
+    else if (arg == L"--help" || arg == L"-h")
+    {
+      PrintUsage();
+      return EXIT_SUCCESS;
+    }
+    else if (arg.compare(0, 2, L"--") == 0)
+    {
+      std::cerr << "Unknown option: " << w2a(arg) << std::endl;
+      PrintUsage();
+      return EXIT_FAILURE;
+    }
+    else
+    {
+      inputs.push_back(arg);
+    }
   }
-  rewind(f);
-  unsigned char *buf = static_cast<unsigned char*>(malloc(size));
-  fread(buf, sizeof(unsigned char), size, f);
-  fclose(f);
-  CSpeedTreeRT *tree = new CSpeedTreeRT;
-  if (!tree->LoadTree(buf, static_cast<unsigned int>(size)))
+  if (wind)
   {
-    std::cerr << "Couldn't load the tree: " << w2a(sptFilePath).c_str() << std::endl;
-    free(buf);
-    delete tree;
+    options.Attributes |= AttrWind;
   }
 
-  // make sure SpeedTreeRT generates normals
-  tree->SetBranchLightingMethod(CSpeedTreeRT::LIGHT_DYNAMIC);
-  tree->SetLeafLightingMethod(CSpeedTreeRT::LIGHT_DYNAMIC);
-  tree->SetFrondLightingMethod(CSpeedTreeRT::LIGHT_DYNAMIC);
-
-  tree->Compute(0, tree->GetSeed());
-
-  ExportTree(tree, sptFilePath);
-
-  free(buf);
-  delete tree;
-  return true;
-}
+  if (serve)
+  {
+    return RunServer(serverOptions);
+  }
 
-int _tmain(int argc, _TCHAR* argv[])
-{
-  std::vector<std::wstring> sourcePaths;
-  if (argc == 1)
+  if (inputs.empty())
   {
     std::wstring path(argv[0]);
     path = path.substr(0, path.find_last_of(L"\\/"));
     std::cout << "Looking for SPTs in: " << w2a(path) << std::endl;
-    ParseDir(path, sourcePaths);
+    std::vector<std::wstring> found;
+    ParseDir(path, found, fromCache);
+    AddSources(1, path, found, sources);
   }
   else
   {
-    for(int idx = 1; idx < argc; ++idx)
+    for(size_t idx = 0; idx < inputs.size(); ++idx)
     {
-      std::wstring path(argv[idx]);
-      if (IsSptFile(path))
+      std::wstring const &path = inputs[idx];
+      std::vector<std::wstring> found;
+      if (IsSptFile(path) || IsGeometryCachePath(path))
       {
-        sourcePaths.push_back(path);
+        found.push_back(path);
+        AddSources((int)idx + 1, std::wstring(), found, sources);
       }
       else
       {
         std::cout << "Looking for SPTs in: " << w2a(path).c_str() << std::endl;
-        ParseDir(path, sourcePaths);
+        ParseDir(path, found, fromCache);
+        AddSources((int)idx + 1, path, found, sources);
       }
     }
   }
   
 
-  if (sourcePaths.empty())
+  if (sources.empty())
   {
     std::wcerr << "No input! Provide a path to an SPT file or a directory containing SPTs" << std::endl;
-    system("pause");
+    Pause(interactive);
     return EXIT_FAILURE;
   }
 
-  std::wcout << "Found " << sourcePaths.size() << " items" << std::endl;
-  for (int i = 0; i < sourcePaths.size(); ++i)
+  Manifest manifest;
+  if (!manifestPath.empty() && !manifest.Open(manifestPath))
+  {
+    std::cerr << "Failed to write: " << w2a(manifestPath) << std::endl;
+    return EXIT_FAILURE;
+  }
+
+  const size_t discovered = sources.size();
+  if (shard.Count > 1)
+  {
+    sources = SelectShard(sources, shard);
+    std::cout << "Shard " << shard.Index + 1 << "/" << shard.Count << ": " << sources.size() << " of " << discovered << " items" << std::endl;
+  }
+
+  const double start = GetTimeMs();
+  int failed = 0;
+  unsigned long long bytes = 0;
+  int warned = 0;
+  std::wcout << "Found " << sources.size() << " items" << std::endl;
+  for (int i = 0; i < sources.size(); ++i)
   {
-    std::cout << i + 1 << "/" << sourcePaths.size() << ". ";
-    ProcessTree(sourcePaths[i]);
+    std::cout << i + 1 << "/" << sources.size() << ". ";
+    Job job;
+    job.Id = w2a(sources[i].Key);
+    job.Input = sources[i].Path;
+    job.Options = options;
+    std::wstring name = job.Input.substr(job.Input.find_last_of(L"\\/") + 1);
+    name = name.substr(0, name.find_last_of('.'));
+    std::wcout << "Exporting " << name << "... ";
+    ExportResult result;
+    if (ProcessTree(job.Input, job.Options, result))
+    {
+      std::cout << "Done. " << (long long)result.TotalMs << " ms, " << FormatSize(result.OutputBytes);
+      if (options.Weld)
+      {
+        std::cout << ", " << result.WeldedVertices << " vertices welded";
+      }
+      std::cout << std::endl;
+      bytes += result.OutputBytes;
+      if (options.Validate)
+      {
+        std::cout << "  " << FormatStats(result.Stats) << std::endl;
+      }
+      for (size_t w = 0; w < result.Warnings.size(); ++w)
+      {
+        std::cout << "  Warning: " << result.Warnings[w] << std::endl;
+      }
+      warned += !result.Warnings.empty();
+    }
+    else
+    {
+      std::cout << result.Error << std::endl;
+      failed++;
+    }
+    manifest.AddLine(FormatResult(job, result));
   }
-  std::wcout << "Finished" << std::endl;
+  manifest.AddLine(FormatShardRecord(shard, discovered, sources.size(), failed, GetTimeMs() - start));
+  std::cout << "Finished in " << (long long)(GetTimeMs() - start) << " ms: " << sources.size() - failed << " trees, " << FormatSize(bytes) << " (" << FormatAttributes(options.Attributes) << ")";
+  if (warned)
+  {
+    std::cout << ", " << warned << " with warnings";
+  }
+  std::cout << std::endl;
   std::cout.flush();
-  std::system("pause");
-  return EXIT_SUCCESS;
+  Pause(interactive);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
 }
-
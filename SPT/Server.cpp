@@ -0,0 +1,415 @@
+#include "Server.h"
+#include "Common.h"
+#include "Export.h"
+#include "Job.h"
+#include "Thread.h"
+
+#include <io.h>
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include <vector>
+
+class Channel
+{
+public:
+  virtual ~Channel() {}
+  // Returns false on end of input
+  virtual bool ReadLine(std::string &line) = 0;
+  // Safe to call from several threads
+  virtual bool WriteLine(std::string const &line) = 0;
+};
+
+class StdioChannel : public Channel
+{
+public:
+  StdioChannel(FILE *in, FILE *out)
+    : In(in)
+    , Out(out)
+  {
+  }
+
+  bool ReadLine(std::string &line)
+  {
+    line.clear();
+    char buf[4096];
+    while (fgets(buf, sizeof(buf), In))
+    {
+      line += buf;
+      if (!line.empty() && line[line.size() - 1] == '\n')
+      {
+        return true;
+      }
+    }
+    return !line.empty();
+  }
+
+  bool WriteLine(std::string const &line)
+  {
+    ScopedLock lock(WriteLock);
+    fwrite(line.c_str(), 1, line.size(), Out);
+    fputc('\n', Out);
+    return fflush(Out) == 0;
+  }
+
+private:
+  FILE *In;
+  FILE *Out;
+  Mutex WriteLock;
+};
+
+// Reads and writes of a duplex pipe happen on different threads, so the handle is
+// opened for overlapped I/O. A synchronous handle would block writes behind a pending read.
+class PipeChannel : public Channel
+{
+public:
+  PipeChannel(HANDLE pipe)
+    : Pipe(pipe)
+  {
+    ReadEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+  }
+
+  ~PipeChannel()
+  {
+    CloseHandle(ReadEvent);
+  }
+
+  bool ReadLine(std::string &line)
+  {
+    while (true)
+    {
+      size_t eol = Pending.find('\n');
+      if (eol != std::string::npos)
+      {
+        line = Pending.substr(0, eol + 1);
+        Pending.erase(0, eol + 1);
+        return true;
+      }
+      char buf[4096];
+      DWORD read = 0;
+      if (!Transfer(ReadEvent, buf, sizeof(buf), read, false) || !read)
+      {
+        line = Pending;
+        Pending.clear();
+        return !line.empty();
+      }
+      Pending.append(buf, read);
+    }
+  }
+
+  bool WriteLine(std::string const &line)
+  {
+    ScopedLock lock(WriteLock);
+    std::string data = line + "\n";
+    HANDLE writeEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    DWORD written = 0;
+    bool ok = Transfer(writeEvent, const_cast<char*>(data.c_str()), (DWORD)data.size(), written, true) && written == data.size();
+    CloseHandle(writeEvent);
+    return ok;
+  }
+
+private:
+  bool Transfer(HANDLE event, char *buf, DWORD size, DWORD &done, bool write)
+  {
+    OVERLAPPED ov;
+    memset(&ov, 0, sizeof(ov));
+    ov.hEvent = event;
+    BOOL ok = write ? WriteFile(Pipe, buf, size, NULL, &ov) : ReadFile(Pipe, buf, size, NULL, &ov);
+    if (!ok && GetLastError() != ERROR_IO_PENDING && GetLastError() != ERROR_MORE_DATA)
+    {
+      return false;
+    }
+    if (!GetOverlappedResult(Pipe, &ov, &done, TRUE))
+    {
+      return GetLastError() == ERROR_MORE_DATA;
+    }
+    return true;
+  }
+
+  HANDLE Pipe;
+  HANDLE ReadEvent;
+  std::string Pending;
+  Mutex WriteLock;
+};
+
+// Jobs of one connection. The reader waits for all of them before the connection is closed.
+struct Session
+{
+  Session(Channel &reply)
+    : Reply(reply)
+  {
+  }
+  Channel &Reply;
+  Semaphore Completed;
+};
+
+struct QueuedJob
+{
+  Job Task;
+  Session *Owner;
+};
+
+class JobQueue
+{
+public:
+  void Push(QueuedJob *job)
+  {
+    {
+      ScopedLock lock(QueueLock);
+      Jobs.push_back(job);
+    }
+    Available.Post();
+  }
+
+  // Blocks until a job is available. NULL tells the worker to exit.
+  QueuedJob *Pop()
+  {
+    Available.Wait();
+    ScopedLock lock(QueueLock);
+    QueuedJob *job = Jobs.front();
+    Jobs.pop_front();
+    return job;
+  }
+
+private:
+  Mutex QueueLock;
+  Semaphore Available;
+  std::deque<QueuedJob*> Jobs;
+};
+
+static void WorkerMain(void *arg)
+{
+  JobQueue *queue = static_cast<JobQueue*>(arg);
+  // The manager and its loaded plugins stay warm for the lifetime of the worker
+  FbxManager *manager = CreateSdkManager();
+  while (QueuedJob *job = queue->Pop())
+  {
+    ExportResult result;
+    if (!manager)
+    {
+      result.Error = "Failed to initialize FBX SDK";
+    }
+    else
+    {
+      ProcessTree(job->Task.Input, job->Task.Options, result, manager);
+    }
+    job->Owner->Reply.WriteLine(FormatResult(job->Task, result));
+    job->Owner->Completed.Post();
+    delete job;
+  }
+  DestroySdkObjects(manager);
+}
+
+// Reads jobs until the end of input or a shutdown command. Returns true on shutdown.
+// Jobs that don't set "threads" extract with jobThreads, so workers don't oversubscribe the CPUs.
+static bool RunSession(Channel &channel, JobQueue &queue, int jobThreads)
+{
+  Session session(channel);
+  int submitted = 0;
+  bool shutdown = false;
+  std::string line;
+  while (!shutdown && channel.ReadLine(line))
+  {
+    while (!line.empty() && (line[line.size() - 1] == '\n' || line[line.size() - 1] == '\r'))
+    {
+      line.erase(line.size() - 1);
+    }
+    if (line.find_first_not_of(" \t") == std::string::npos)
+    {
+      continue;
+    }
+
+    JsonValue value;
+    std::string error;
+    if (!ParseJson(line, value, error))
+    {
+      channel.WriteLine(FormatError(std::string(), "Malformed job: " + error));
+      continue;
+    }
+    if (value.GetString("cmd") == "shutdown")
+    {
+      shutdown = true;
+      continue;
+    }
+
+    QueuedJob *job = new QueuedJob;
+    job->Owner = &session;
+    if (!ParseJob(value, job->Task, error))
+    {
+      channel.WriteLine(FormatError(value.GetString("id"), error));
+      delete job;
+      continue;
+    }
+    if (job->Task.Options.Threads <= 0)
+    {
+      job->Task.Options.Threads = jobThreads;
+    }
+    queue.Push(job);
+    submitted++;
+  }
+
+  for (int i = 0; i < submitted; ++i)
+  {
+    session.Completed.Wait();
+  }
+  return shutdown;
+}
+
+static HANDLE AcceptPipeClient(std::wstring const &name)
+{
+  HANDLE pipe = CreateNamedPipe(name.c_str(), PIPE_ACCESS_DUPLEX | FILE_FLAG_OVERLAPPED, PIPE_TYPE_BYTE | PIPE_READMODE_BYTE | PIPE_WAIT, 1, 64 * 1024, 64 * 1024, 0, NULL);
+  if (pipe == INVALID_HANDLE_VALUE)
+  {
+    return pipe;
+  }
+  OVERLAPPED ov;
+  memset(&ov, 0, sizeof(ov));
+  ov.hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+  bool connected = ConnectNamedPipe(pipe, &ov) != FALSE;
+  if (!connected)
+  {
+    DWORD err = GetLastError();
+    DWORD unused = 0;
+    connected = err == ERROR_PIPE_CONNECTED || (err == ERROR_IO_PENDING && GetOverlappedResult(pipe, &ov, &unused, TRUE));
+  }
+  CloseHandle(ov.hEvent);
+  if (!connected)
+  {
+    CloseHandle(pipe);
+    return INVALID_HANDLE_VALUE;
+  }
+  return pipe;
+}
+
+int RunServer(ServerOptions const &options)
+{
+  const int workerCount = options.Workers > 0 ? options.Workers : GetProcessorCount();
+  const int jobThreads = std::max(1, GetProcessorCount() / workerCount);
+  JobQueue queue;
+  std::vector<Thread*> workers;
+
+  int ret = EXIT_SUCCESS;
+  if (options.PipeName.empty())
+  {
+    // Keep the result stream clean: anything the SDKs print goes to stderr
+    fflush(stdout);
+    FILE *results = _fdopen(_dup(_fileno(stdout)), "wb");
+    _dup2(_fileno(stderr), _fileno(stdout));
+    if (!results)
+    {
+      std::cerr << "Failed to open the result stream" << std::endl;
+      return EXIT_FAILURE;
+    }
+
+    for (int i = 0; i < workerCount; ++i)
+    {
+      workers.push_back(new Thread(WorkerMain, &queue));
+    }
+    StdioChannel channel(stdin, results);
+    RunSession(channel, queue, jobThreads);
+    fclose(results);
+  }
+  else
+  {
+    for (int i = 0; i < workerCount; ++i)
+    {
+      workers.push_back(new Thread(WorkerMain, &queue));
+    }
+    std::cerr << "Listening on " << w2a(options.PipeName) << " with " << workerCount << " workers" << std::endl;
+    bool shutdown = false;
+    while (!shutdown)
+    {
+      HANDLE pipe = AcceptPipeClient(options.PipeName);
+      if (pipe == INVALID_HANDLE_VALUE)
+      {
+        std::cerr << "Failed to open pipe: " << w2a(options.PipeName) << std::endl;
+        ret = EXIT_FAILURE;
+        break;
+      }
+      {
+        PipeChannel channel(pipe);
+        shutdown = RunSession(channel, queue, jobThreads);
+      }
+      FlushFileBuffers(pipe);
+      DisconnectNamedPipe(pipe);
+      CloseHandle(pipe);
+    }
+  }
+
+  for (size_t i = 0; i < workers.size(); ++i)
+  {
+    queue.Push(NULL);
+  }
+  for (size_t i = 0; i < workers.size(); ++i)
+  {
+    delete workers[i];
+  }
+  return ret;
+}
+
+int RunClient(std::wstring const &pipeName, std::wstring const &jobsPath)
+{
+  FILE *jobs = NULL;
+  if (_wfopen_s(&jobs, jobsPath.c_str(), L"rb"))
+  {
+    std::cerr << "Failed to open: " << w2a(jobsPath) << std::endl;
+    return EXIT_FAILURE;
+  }
+  HANDLE pipe = CreateFile(pipeName.c_str(), GENERIC_READ | GENERIC_WRITE, 0, NULL, OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+  if (pipe == INVALID_HANDLE_VALUE)
+  {
+    std::cerr << "Failed to connect to: " << w2a(pipeName) << std::endl;
+    fclose(jobs);
+    return EXIT_FAILURE;
+  }
+
+  int sent = 0;
+  PipeChannel channel(pipe);
+  {
+    StdioChannel input(jobs, NULL);
+    std::string line;
+    while (input.ReadLine(line))
+    {
+      if (line.find_first_not_of(" \t\r\n") == std::string::npos)
+      {
+        continue;
+      }
+      while (!line.empty() && (line[line.size() - 1] == '\n' || line[line.size() - 1] == '\r'))
+      {
+        line.erase(line.size() - 1);
+      }
+      JsonValue value;
+      std::string error;
+      // Commands do not produce a result line
+      if (ParseJson(line, value, error) && !value.GetString("cmd").empty())
+      {
+        channel.WriteLine(line);
+        continue;
+      }
+      if (!channel.WriteLine(line))
+      {
+        std::cerr << "Failed to send a job" << std::endl;
+        break;
+      }
+      sent++;
+    }
+  }
+  fclose(jobs);
+
+  int failed = 0;
+  std::string line;
+  for (int received = 0; received < sent && channel.ReadLine(line); ++received)
+  {
+    std::cout << line;
+    JsonValue value;
+    std::string error;
+    if (!ParseJson(line, value, error) || value.GetString("status") != "ok")
+    {
+      failed++;
+    }
+  }
+  CloseHandle(pipe);
+  std::cout.flush();
+  std::cerr << sent << " jobs sent, " << failed << " failed" << std::endl;
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
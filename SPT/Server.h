@@ -0,0 +1,24 @@
+#ifndef _SERVER_H
+#define _SERVER_H
+
+#include <string>
+
+struct ServerOptions
+{
+  ServerOptions()
+  {
+    Workers = 0;
+  }
+  std::wstring PipeName; // Empty: read jobs from stdin, write results to stdout
+  int Workers;           // 0: one per processor
+};
+
+// Non-interactive batch mode. Reads newline-delimited JSON jobs and streams back one
+// JSON result line per job. Results are written in completion order, match them by "id".
+int RunServer(ServerOptions const &options);
+
+// Test client: sends every line of jobsPath to a server listening on pipeName
+// and prints the results. Returns non-zero if any job failed.
+int RunClient(std::wstring const &pipeName, std::wstring const &jobsPath);
+
+#endif // #ifndef _SERVER_H
@@ -0,0 +1,102 @@
+#include "Shard.h"
+#include "Common.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <cwctype>
+
+bool ParseShardSpec(std::wstring const &text, ShardSpec &spec)
+{
+  size_t slash = text.find(L'/');
+  if (slash == std::wstring::npos)
+  {
+    return false;
+  }
+  int index = _wtoi(text.substr(0, slash).c_str());
+  int count = _wtoi(text.substr(slash + 1).c_str());
+  if (count < 1 || index < 1 || index > count)
+  {
+    return false;
+  }
+  spec.Index = index - 1;
+  spec.Count = count;
+  return true;
+}
+
+std::wstring MakeShardKey(std::wstring const &path)
+{
+  std::wstring key(path);
+  for (size_t i = 0; i < key.size(); ++i)
+  {
+    key[i] = key[i] == L'\\' ? L'/' : (wchar_t)towlower(key[i]);
+  }
+  return key;
+}
+
+unsigned long long HashShardKey(std::wstring const &key)
+{
+  // FNV-1a over UTF-8 so the value doesn't depend on wchar_t size
+  std::string bytes = w2a(key);
+  unsigned long long hash = 14695981039346656037ULL;
+  for (size_t i = 0; i < bytes.size(); ++i)
+  {
+    hash ^= (unsigned char)bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+struct BySizeDesc
+{
+  BySizeDesc(std::vector<SourceFile> const &files)
+    : Files(files)
+  {
+  }
+  bool operator()(size_t a, size_t b) const
+  {
+    if (Files[a].Size != Files[b].Size)
+    {
+      return Files[a].Size > Files[b].Size;
+    }
+    return Files[a].Key < Files[b].Key;
+  }
+  std::vector<SourceFile> const &Files;
+};
+
+std::vector<SourceFile> SelectShard(std::vector<SourceFile> const &files, ShardSpec const &spec)
+{
+  std::vector<bool> selected(files.size(), false);
+  if (!spec.BalanceBySize)
+  {
+    for (size_t i = 0; i < files.size(); ++i)
+    {
+      selected[i] = HashShardKey(files[i].Key) % spec.Count == (unsigned long long)spec.Index;
+    }
+  }
+  else
+  {
+    std::vector<size_t> order(files.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+      order[i] = i;
+    }
+    std::sort(order.begin(), order.end(), BySizeDesc(files));
+    std::vector<unsigned long long> load(spec.Count, 0);
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+      int target = (int)(std::min_element(load.begin(), load.end()) - load.begin());
+      load[target] += files[order[i]].Size;
+      selected[order[i]] = target == spec.Index;
+    }
+  }
+
+  std::vector<SourceFile> result;
+  for (size_t i = 0; i < files.size(); ++i)
+  {
+    if (selected[i])
+    {
+      result.push_back(files[i]);
+    }
+  }
+  return result;
+}
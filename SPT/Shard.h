@@ -0,0 +1,46 @@
+#ifndef _SHARD_H
+#define _SHARD_H
+
+#include <string>
+#include <vector>
+
+// Splits a batch across machines. Every node discovers the same set of sources
+// on a shared filesystem and keeps only its own slice, no coordination needed.
+struct ShardSpec
+{
+  ShardSpec()
+  {
+    Index = 0;
+    Count = 1;
+    BalanceBySize = false;
+  }
+  int Index; // 0-based
+  int Count;
+  bool BalanceBySize;
+};
+
+struct SourceFile
+{
+  SourceFile()
+  {
+    Size = 0;
+  }
+  std::wstring Path;
+  std::wstring Key; // Input number plus the path below the input, identical on every node
+  unsigned long long Size;
+};
+
+// Parses "i/N" with 1 <= i <= N
+bool ParseShardSpec(std::wstring const &text, ShardSpec &spec);
+
+// Normalized key of a source path: lower case, forward slashes
+std::wstring MakeShardKey(std::wstring const &path);
+
+unsigned long long HashShardKey(std::wstring const &key);
+
+// Returns the files assigned to spec.Index, in their original order.
+// By hash: a file goes to hash(key) % N. By size: largest files first, each to the
+// least loaded shard, ties broken by key so that every node computes the same plan.
+std::vector<SourceFile> SelectShard(std::vector<SourceFile> const &files, ShardSpec const &spec);
+
+#endif // #ifndef _SHARD_H
@@ -0,0 +1,211 @@
+#include "Thread.h"
+
+#include <vector>
+
+#ifdef _WIN32
+#include <process.h>
+
+Mutex::Mutex()
+{
+  InitializeCriticalSection(&Section);
+}
+
+Mutex::~Mutex()
+{
+  DeleteCriticalSection(&Section);
+}
+
+void Mutex::Lock()
+{
+  EnterCriticalSection(&Section);
+}
+
+void Mutex::Unlock()
+{
+  LeaveCriticalSection(&Section);
+}
+
+Semaphore::Semaphore()
+{
+  Handle = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL);
+}
+
+Semaphore::~Semaphore()
+{
+  CloseHandle(Handle);
+}
+
+void Semaphore::Post(int count)
+{
+  ReleaseSemaphore(Handle, count, NULL);
+}
+
+void Semaphore::Wait()
+{
+  WaitForSingleObject(Handle, INFINITE);
+}
+
+Thread::Thread(ThreadProc proc, void *arg)
+  : Proc(proc)
+  , Arg(arg)
+{
+  Handle = (HANDLE)_beginthreadex(NULL, 0, &Thread::Entry, this, 0, NULL);
+}
+
+Thread::~Thread()
+{
+  Join();
+}
+
+void Thread::Join()
+{
+  if (Handle)
+  {
+    WaitForSingleObject(Handle, INFINITE);
+    CloseHandle(Handle);
+    Handle = NULL;
+  }
+}
+
+unsigned __stdcall Thread::Entry(void *self)
+{
+  Thread *t = static_cast<Thread*>(self);
+  t->Proc(t->Arg);
+  return 0;
+}
+
+int GetProcessorCount()
+{
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return info.dwNumberOfProcessors > 0 ? (int)info.dwNumberOfProcessors : 1;
+}
+#else
+#include <unistd.h>
+
+Mutex::Mutex()
+{
+  pthread_mutex_init(&Section, NULL);
+}
+
+Mutex::~Mutex()
+{
+  pthread_mutex_destroy(&Section);
+}
+
+void Mutex::Lock()
+{
+  pthread_mutex_lock(&Section);
+}
+
+void Mutex::Unlock()
+{
+  pthread_mutex_unlock(&Section);
+}
+
+Semaphore::Semaphore()
+{
+  sem_init(&Handle, 0, 0);
+}
+
+Semaphore::~Semaphore()
+{
+  sem_destroy(&Handle);
+}
+
+void Semaphore::Post(int count)
+{
+  for (int i = 0; i < count; ++i)
+  {
+    sem_post(&Handle);
+  }
+}
+
+void Semaphore::Wait()
+{
+  // Retried when a signal interrupts the wait
+  while (sem_wait(&Handle) != 0)
+  {
+  }
+}
+
+Thread::Thread(ThreadProc proc, void *arg)
+  : Proc(proc)
+  , Arg(arg)
+{
+  Joinable = pthread_create(&Handle, NULL, &Thread::Entry, this) == 0;
+}
+
+Thread::~Thread()
+{
+  Join();
+}
+
+void Thread::Join()
+{
+  if (Joinable)
+  {
+    pthread_join(Handle, NULL);
+    Joinable = false;
+  }
+}
+
+void *Thread::Entry(void *self)
+{
+  Thread *t = static_cast<Thread*>(self);
+  t->Proc(t->Arg);
+  return NULL;
+}
+
+int GetProcessorCount()
+{
+  const long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return count > 0 ? (int)count : 1;
+}
+#endif
+
+struct ParallelForState
+{
+  Mutex Lock;
+  int Next;
+  int Count;
+  TaskProc Proc;
+  void *Context;
+};
+
+static void ParallelForWorker(void *arg)
+{
+  ParallelForState &state = *static_cast<ParallelForState*>(arg);
+  for (;;)
+  {
+    int task;
+    {
+      ScopedLock lock(state.Lock);
+      task = state.Next++;
+    }
+    if (task >= state.Count)
+    {
+      return;
+    }
+    state.Proc(state.Context, task);
+  }
+}
+
+void ParallelFor(int count, int threads, TaskProc proc, void *context)
+{
+  ParallelForState state;
+  state.Next = 0;
+  state.Count = count;
+  state.Proc = proc;
+  state.Context = context;
+  std::vector<Thread*> workers;
+  for (int i = 1; i < threads && i < count; ++i)
+  {
+    workers.push_back(new Thread(ParallelForWorker, &state));
+  }
+  ParallelForWorker(&state);
+  for (size_t i = 0; i < workers.size(); ++i)
+  {
+    delete workers[i];
+  }
+}
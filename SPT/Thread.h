@@ -0,0 +1,105 @@
+#ifndef _THREAD_H
+#define _THREAD_H
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <pthread.h>
+#include <semaphore.h>
+#endif
+
+// Thin wrappers over the Win32 primitives used by the batch server. The POSIX
+// versions only serve the portable core (extraction and the regression target).
+
+class Mutex
+{
+public:
+  Mutex();
+  ~Mutex();
+  void Lock();
+  void Unlock();
+
+private:
+  Mutex(Mutex const&);
+  Mutex &operator=(Mutex const&);
+#ifdef _WIN32
+  CRITICAL_SECTION Section;
+#else
+  pthread_mutex_t Section;
+#endif
+};
+
+class ScopedLock
+{
+public:
+  ScopedLock(Mutex &m)
+    : M(m)
+  {
+    M.Lock();
+  }
+  ~ScopedLock()
+  {
+    M.Unlock();
+  }
+
+private:
+  ScopedLock(ScopedLock const&);
+  ScopedLock &operator=(ScopedLock const&);
+  Mutex &M;
+};
+
+class Semaphore
+{
+public:
+  Semaphore();
+  ~Semaphore();
+  void Post(int count = 1);
+  void Wait();
+
+private:
+  Semaphore(Semaphore const&);
+  Semaphore &operator=(Semaphore const&);
+#ifdef _WIN32
+  HANDLE Handle;
+#else
+  sem_t Handle;
+#endif
+};
+
+typedef void (*ThreadProc)(void *arg);
+
+class Thread
+{
+public:
+  Thread(ThreadProc proc, void *arg);
+  ~Thread();
+  void Join();
+
+private:
+  Thread(Thread const&);
+  Thread &operator=(Thread const&);
+#ifdef _WIN32
+  static unsigned __stdcall Entry(void *self);
+#else
+  static void *Entry(void *self);
+#endif
+
+  ThreadProc Proc;
+  void *Arg;
+#ifdef _WIN32
+  HANDLE Handle;
+#else
+  pthread_t Handle;
+  bool Joinable;
+#endif
+};
+
+int GetProcessorCount();
+
+typedef void (*TaskProc)(void *context, int task);
+
+// Runs proc for tasks 0..count-1 on up to threads threads, the calling one included,
+// and returns when all of them are done
+void ParallelFor(int count, int threads, TaskProc proc, void *context);
+
+#endif // #ifndef _THREAD_H
@@ -0,0 +1,534 @@
+#include "TreeGeometry.h"
+#include "Thread.h"
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+
+// Vertex channels to fill, NULL for the ones that aren't exported
+struct MeshChannels
+{
+  MeshChannels(TreeMesh &m)
+  {
+    Normals = m.Attributes & AttrNormals ? &m.Normals : NULL;
+    Binormals = m.Attributes & AttrBinormals ? &m.Binormals : NULL;
+    Tangents = m.Attributes & AttrTangents ? &m.Tangents : NULL;
+    Colors = m.Attributes & AttrColors ? &m.Colors : NULL;
+    for (int uv = 0; uv < UVSetCount; ++uv)
+    {
+      UVs[uv] = m.Attributes & UVAttribute(uv) ? &m.UVs[uv] : NULL;
+    }
+    Wind = m.Attributes & AttrWind ? &m.Wind : NULL;
+  }
+  std::vector<float> *Normals;
+  std::vector<float> *Binormals;
+  std::vector<float> *Tangents;
+  std::vector<unsigned char> *Colors;
+  std::vector<double> *UVs[UVSetCount];
+  std::vector<float> *Wind;
+};
+
+// SpeedTree is y-up left-handed, the scene is z-up right-handed: flip y
+template<typename T>
+inline void AddFlipped(std::vector<T> *v, double x, double y, double z)
+{
+  if (v)
+  {
+    v->push_back((T)x);
+    v->push_back((T)-y);
+    v->push_back((T)z);
+  }
+}
+
+inline void AddUV(std::vector<double> *v, double u, double w)
+{
+  if (v)
+  {
+    v->push_back(u);
+    v->push_back(w);
+  }
+}
+
+inline void AddColor(std::vector<unsigned char> *v, const unsigned int *color)
+{
+  if (!v)
+  {
+    return;
+  }
+  if (color)
+  {
+    const unsigned char *c = (const unsigned char *)color;
+    v->insert(v->end(), c, c + 4);
+  }
+  else
+  {
+    const unsigned char black[] = {0, 0, 0, 255};
+    v->insert(v->end(), black, black + 4);
+  }
+}
+
+// Wind data of element i, zero where SpeedTree has none
+inline void AddWind(std::vector<float> *v, const float *const weights[2], const unsigned char *const matrices[2], int i)
+{
+  if (v)
+  {
+    for (int level = 0; level < 2; ++level)
+    {
+      v->push_back(weights[level] ? weights[level][i] : 0.f);
+      v->push_back(matrices[level] ? (float)matrices[level][i] : 0.f);
+    }
+  }
+}
+
+inline void AddTriangle(TreeMesh &m, int a, int b, int c, int material, int group, int element, MeshSection section)
+{
+  m.Indices.push_back(a);
+  m.Indices.push_back(b);
+  m.Indices.push_back(c);
+  m.Materials.push_back(material);
+  m.Groups.push_back(group);
+  m.Elements.push_back(element);
+  m.Sections.push_back((unsigned char)section);
+}
+
+// Indexed geometry contains vertices for all LODs.
+// Collects vertices used by the LOD in the order of their first use.
+static void CollectStripVertices(IndexedLod const &s, std::vector<int> &unique, std::vector<int> &remap)
+{
+  for(int strip = 0; strip < s.StripCount; ++strip)
+  {
+    const int length = s.StripLengths[strip];
+    const int *indices = s.Strips[strip];
+
+    for(int i = 0; i < length - 2; ++i)
+    {
+      for (int j = 0; j < 3; ++j)
+      {
+        int idx = indices[i + j];
+        if (idx >= (int)remap.size())
+        {
+          remap.resize(idx + 1, -1);
+        }
+        if (remap[idx] == -1)
+        {
+          remap[idx] = (int)unique.size();
+          unique.push_back(idx);
+        }
+      }
+    }
+  }
+}
+
+static void ExtractIndexed(IndexedGeometry const &s, int lod, int stripEnd, int material, int group, MeshSection section, TreeMesh &m)
+{
+  IndexedLod const &l = s.Lods[lod];
+  std::vector<int> unique;
+  std::vector<int> remap;
+  CollectStripVertices(l, unique, remap);
+
+  MeshChannels c(m);
+  const int offset = m.GetVertexCount();
+  for (size_t i = 0; i < unique.size(); ++i)
+  {
+    int idx = unique[i];
+    const float *pos = &s.Coords[idx * 3];
+    const float *normal = &s.Normals[idx * 3];
+    const float *binorm = &s.Binormals[idx * 3];
+    const float *tangent = &s.Tangents[idx * 3];
+    const float *uvs = &s.TexCoords[idx * 2];
+    AddFlipped(&m.Positions, pos[0], pos[1], pos[2]);
+    AddFlipped(c.Normals, normal[0], normal[1], normal[2]);
+    AddFlipped(c.Binormals, binorm[0], binorm[1], binorm[2]);
+    AddFlipped(c.Tangents, tangent[0], tangent[1], tangent[2]);
+    AddUV(c.UVs[UVDiffuse], uvs[0], uvs[1]);
+    AddUV(c.UVs[UVSize], 0, 0);
+    AddUV(c.UVs[UVCenterXY], 0, 0);
+    AddUV(c.UVs[UVCenterZDimming], 0, 0);
+    AddUV(c.UVs[UVPivot], 0, 0);
+    AddColor(c.Colors, s.Colors ? &s.Colors[idx] : NULL);
+    AddWind(c.Wind, s.WindWeights, s.WindMatrixIndices, idx);
+  }
+
+  for(int strip = 0; strip < l.StripCount; ++strip)
+  {
+    const int length = l.StripLengths[strip];
+    const int *indices = l.Strips[strip];
+
+    // Branch strips historically stop one triangle earlier than frond strips
+    for(int i = 0; i < length - stripEnd; ++i)
+    {
+      int polygon[3] = {indices[i], indices[i+1], indices[i+2]};
+      if (i % 2 == 0)
+      {
+        std::swap(polygon[0], polygon[1]);
+      }
+      AddTriangle(m, offset + remap[polygon[0]], offset + remap[polygon[1]], offset + remap[polygon[2]], material, group, strip, section);
+    }
+  }
+}
+
+static void ExtractLeafCards(LeafLod const &s, int begin, int end, int material, int group, TreeMesh &m)
+{
+  MeshChannels c(m);
+  for (int leaf = begin; leaf < end; ++leaf)
+  {
+    LeafCard const &card = s.Cards[s.CardIndices[leaf]];
+    if (card.Mesh != -1)
+    {
+      continue;
+    }
+    const float *center = &s.Centers[leaf * 3];
+    float pivot[2];
+    pivot[0] = (card.TexCoords[0 * 2] + card.TexCoords[2 * 2]) / 2.;
+    pivot[1] = (card.TexCoords[0 * 2 + 1] + card.TexCoords[2 * 2 + 1]) / 2.;
+    const int offset = m.GetVertexCount();
+    for (int corner = 0; corner < 4; ++corner)
+    {
+      const float *pos = &card.Coords[corner * 4];
+      const float *normal = &s.Normals[12 * leaf + (corner * 3)];
+      const float *binorm = &s.Binormals[12 * leaf + (corner * 3)];
+      const float *tangent = &s.Tangents[12 * leaf + (corner * 3)];
+      const float *uvs = &card.TexCoords[corner * 2];
+      AddFlipped(&m.Positions, (double)(pos[0] + center[0]), (double)(pos[1] + center[1]), (double)(pos[2] + center[2]));
+      AddFlipped(c.Normals, normal[0], normal[1], normal[2]);
+      AddFlipped(c.Binormals, binorm[0], binorm[1], binorm[2]);
+      AddFlipped(c.Tangents, tangent[0], tangent[1], tangent[2]);
+      AddUV(c.UVs[UVDiffuse], uvs[0], uvs[1]);
+      AddUV(c.UVs[UVSize], card.Width, card.Height);
+      AddUV(c.UVs[UVCenterXY], center[0], -center[1]);
+      AddUV(c.UVs[UVCenterZDimming], center[2], s.Dimming[leaf]);
+      AddUV(c.UVs[UVPivot], pivot[0], pivot[1]);
+      AddColor(c.Colors, s.Colors ? &s.Colors[leaf * 4 + corner] : NULL);
+      AddWind(c.Wind, s.WindWeights, s.WindMatrixIndices, leaf);
+    }
+    AddTriangle(m, offset, offset + 1, offset + 2, material, group, leaf, SectionLeafCards);
+    AddTriangle(m, offset, offset + 2, offset + 3, material, group, leaf, SectionLeafCards);
+  }
+}
+
+static void ExtractLeafMeshes(LeafLod const &s, int begin, int end, int material, int group, TreeMesh &m)
+{
+  MeshChannels c(m);
+  for (int leaf = begin; leaf < end; ++leaf)
+  {
+    LeafCard const &card = s.Cards[s.CardIndices[leaf]];
+    if (card.Mesh == -1)
+    {
+      continue;
+    }
+    const float *center = &s.Centers[leaf * 3];
+    const float *pivot = card.Pivot;
+    LeafMesh const &mesh = s.Meshes[card.Mesh];
+    const int offset = m.GetVertexCount();
+    for (int vert = 0; vert < mesh.VertexCount; ++vert)
+    {
+      const float *pos = &mesh.Coords[vert * 3];
+      const float *normal = &mesh.Normals[vert * 3];
+      const float *binorm = &mesh.Binormals[vert * 3];
+      const float *tangent = &mesh.Tangents[vert * 3];
+      const float *uvs = &mesh.TexCoords[vert * 2];
+      AddFlipped(&m.Positions, (double)(pos[0] + center[0]), (double)(pos[1] + center[1]), (double)(pos[2] + center[2]));
+      AddFlipped(c.Normals, normal[0], normal[1], normal[2]);
+      AddFlipped(c.Binormals, binorm[0], binorm[1], binorm[2]);
+      AddFlipped(c.Tangents, tangent[0], tangent[1], tangent[2]);
+      AddColor(c.Colors, NULL);
+      AddUV(c.UVs[UVDiffuse], uvs[0], uvs[1]);
+      AddUV(c.UVs[UVSize], card.Width, card.Height);
+      AddUV(c.UVs[UVCenterXY], center[0], center[1]);
+      AddUV(c.UVs[UVCenterZDimming], center[2], s.Dimming[leaf]);
+      AddUV(c.UVs[UVPivot], pivot[0], pivot[1]);
+      AddWind(c.Wind, s.WindWeights, s.WindMatrixIndices, leaf);
+    }
+    for (int i = 0; i < mesh.IndexCount - 2; i+=3)
+    {
+      AddTriangle(m, offset + mesh.Indices[i+1], offset + mesh.Indices[i], offset + mesh.Indices[i+2], material, group, leaf, SectionLeafMeshes);
+    }
+  }
+}
+
+// Trees below this many vertices are extracted on the calling thread
+static const int ParallelMinVertices = 16384;
+static const int LeavesPerTask = 1024;
+
+// A section of the tree, or a range of its leaves. In parallel mode every task fills its
+// own mesh with local vertex indices, otherwise all tasks append to the result.
+struct ExtractTask
+{
+  MeshSection Section;
+  int Begin;
+  int End;
+  int Material;
+  int Group;
+  TreeMesh *Target;
+  int VertexOffset;
+  int TriangleOffset;
+};
+
+struct ExtractContext
+{
+  TreeGeometry const *Geometry;
+  int Lod;
+  std::vector<ExtractTask> Tasks;
+  TreeMesh *Result;
+};
+
+static void RunExtractTask(void *context, int index)
+{
+  ExtractContext const &ctx = *static_cast<ExtractContext*>(context);
+  ExtractTask const &task = ctx.Tasks[index];
+  switch (task.Section)
+  {
+    case SectionBranches:
+      ExtractIndexed(ctx.Geometry->Branches, ctx.Lod, 3, task.Material, task.Group, SectionBranches, *task.Target);
+      break;
+    case SectionFronds:
+      ExtractIndexed(ctx.Geometry->Fronds, ctx.Lod, 2, task.Material, task.Group, SectionFronds, *task.Target);
+      break;
+    case SectionLeafCards:
+      ExtractLeafCards(ctx.Geometry->Leaves[ctx.Lod], task.Begin, task.End, task.Material, task.Group, *task.Target);
+      break;
+    case SectionLeafMeshes:
+      ExtractLeafMeshes(ctx.Geometry->Leaves[ctx.Lod], task.Begin, task.End, task.Material, task.Group, *task.Target);
+      break;
+    default:
+      break;
+  }
+}
+
+template<typename T>
+inline void CopyRange(std::vector<T> const &src, int offset, int size, std::vector<T> &dst)
+{
+  if (!src.empty())
+  {
+    std::copy(src.begin(), src.end(), dst.begin() + (size_t)offset * size);
+  }
+}
+
+// Moves a task's mesh to its place in the result, vertex indices become global
+static void CopyExtractTask(void *context, int index)
+{
+  ExtractContext const &ctx = *static_cast<ExtractContext*>(context);
+  ExtractTask const &task = ctx.Tasks[index];
+  TreeMesh const &src = *task.Target;
+  TreeMesh &m = *ctx.Result;
+  CopyRange(src.Positions, task.VertexOffset, 3, m.Positions);
+  CopyRange(src.Normals, task.VertexOffset, 3, m.Normals);
+  CopyRange(src.Binormals, task.VertexOffset, 3, m.Binormals);
+  CopyRange(src.Tangents, task.VertexOffset, 3, m.Tangents);
+  CopyRange(src.Colors, task.VertexOffset, 4, m.Colors);
+  for (int uv = 0; uv < UVSetCount; ++uv)
+  {
+    CopyRange(src.UVs[uv], task.VertexOffset, 2, m.UVs[uv]);
+  }
+  CopyRange(src.Wind, task.VertexOffset, 4, m.Wind);
+  for (size_t i = 0; i < src.Indices.size(); ++i)
+  {
+    m.Indices[(size_t)task.TriangleOffset * 3 + i] = src.Indices[i] + task.VertexOffset;
+  }
+  CopyRange(src.Materials, task.TriangleOffset, 1, m.Materials);
+  CopyRange(src.Groups, task.TriangleOffset, 1, m.Groups);
+  CopyRange(src.Elements, task.TriangleOffset, 1, m.Elements);
+  CopyRange(src.Sections, task.TriangleOffset, 1, m.Sections);
+}
+
+static void AddTask(ExtractContext &ctx, MeshSection section, int begin, int end, int material, int group)
+{
+  ExtractTask task;
+  task.Section = section;
+  task.Begin = begin;
+  task.End = end;
+  task.Material = material;
+  task.Group = group;
+  task.Target = ctx.Result;
+  task.VertexOffset = 0;
+  task.TriangleOffset = 0;
+  ctx.Tasks.push_back(task);
+}
+
+template<typename T>
+inline void ResizeChannel(std::vector<T> &v, bool present, size_t size)
+{
+  v.resize(present ? size : 0);
+}
+
+bool ExtractTree(TreeGeometry const &geometry, ExtractOptions const &options, TreeMesh &m)
+{
+  const int lod = options.Lod;
+  if (lod < 0)
+  {
+    return false;
+  }
+  m.Attributes = options.Attributes;
+  const bool branches = (options.Sections & SectionBit(SectionBranches)) != 0;
+  const bool fronds = (options.Sections & SectionBit(SectionFronds)) != 0;
+  const bool leafCards = (options.Sections & SectionBit(SectionLeafCards)) != 0;
+  const bool leafMeshes = (options.Sections & SectionBit(SectionLeafMeshes)) != 0;
+  int branchMatIdx = -1;
+  int frondMatIdx = -1;
+  int leafMatIdx = -1;
+  std::string leafName("LeafMAT");
+  const char *uData = geometry.UserData;
+  if (uData && uData[0] == '$') // Real Editor's material mapping for UE4 import
+  {
+    int pos = 1;
+    while (pos)
+    {
+      const char mType = uData[pos]; pos++;
+      if (!mType || (mType != 'b' && mType != 'f' && mType != 'l'))
+      {
+        break;
+      }
+      int length = uData[pos]; pos++;
+      if (length < 0 || strlen(&uData[pos]) < (size_t)length) // truncated mapping
+      {
+        break;
+      }
+      std::string name(&uData[pos], length);
+      pos += length;
+      switch (mType)
+      {
+        case 'b':
+          if (branches)
+          {
+            branchMatIdx = (int)m.MaterialNames.size();
+            m.MaterialNames.push_back(name + "_branches");
+          }
+          break;
+        case 'f':
+          if (fronds)
+          {
+            frondMatIdx = (int)m.MaterialNames.size();
+            m.MaterialNames.push_back(name + "_fronds");
+          }
+          break;
+        case 'l':
+          leafName = name + "_leafs";
+          if (leafCards)
+          {
+            leafMatIdx = (int)m.MaterialNames.size();
+            m.MaterialNames.push_back(leafName);
+          }
+          break;
+        default:
+          break;
+      }
+    }
+  }
+
+  // Materials, groups and the order of the sections are decided up front,
+  // the geometry is extracted by the tasks
+
+  ExtractContext ctx;
+  ctx.Geometry = &geometry;
+  ctx.Lod = lod;
+  ctx.Result = &m;
+  int group = 0;
+  int vertices = 0;
+
+  if (branches && (int)geometry.Branches.Lods.size() > lod)
+  {
+    if (branchMatIdx == -1)
+    {
+      branchMatIdx = (int)m.MaterialNames.size();
+      m.MaterialNames.push_back("BranchMAT");
+    }
+    AddTask(ctx, SectionBranches, 0, 0, branchMatIdx, group);
+    vertices += geometry.Branches.VertexCount;
+    group++;
+  }
+
+  if (fronds && (int)geometry.Fronds.Lods.size() > lod)
+  {
+    if (frondMatIdx == -1)
+    {
+      frondMatIdx = (int)m.MaterialNames.size();
+      m.MaterialNames.push_back("FrondMAT");
+    }
+    AddTask(ctx, SectionFronds, 0, 0, frondMatIdx, group);
+    vertices += geometry.Fronds.VertexCount;
+    group++;
+  }
+
+  const bool parallel = options.Threads > 1;
+  if ((leafCards || leafMeshes) && (int)geometry.Leaves.size() > lod)
+  {
+    LeafLod const &s = geometry.Leaves[lod];
+    const int leafCount = s.LeafCount;
+    if (leafCards && leafCount && leafMatIdx == -1)
+    {
+      leafMatIdx = (int)m.MaterialNames.size();
+      m.MaterialNames.push_back(leafName);
+    }
+    bool hasMeshes = false;
+    for (int leaf = 0; leaf < leafCount; ++leaf)
+    {
+      const float *center = &s.Centers[leaf * 3];
+      AddFlipped(&m.LeafCenters, center[0], center[1], center[2]);
+      hasMeshes = hasMeshes || s.Cards[s.CardIndices[leaf]].Mesh != -1;
+    }
+    hasMeshes = hasMeshes && leafMeshes;
+    int leafMatIdx2 = -1;
+    if (hasMeshes)
+    {
+      leafMatIdx2 = (int)m.MaterialNames.size();
+      m.MaterialNames.push_back(leafName + "mesh");
+    }
+
+    const int chunk = parallel ? LeavesPerTask : std::max(leafCount, 1);
+    for (int leaf = 0; leafCards && leaf < leafCount; leaf += chunk)
+    {
+      AddTask(ctx, SectionLeafCards, leaf, std::min(leaf + chunk, leafCount), leafMatIdx, group);
+    }
+    group++;
+    for (int leaf = 0; hasMeshes && leaf < leafCount; leaf += chunk)
+    {
+      AddTask(ctx, SectionLeafMeshes, leaf, std::min(leaf + chunk, leafCount), leafMatIdx2, group);
+    }
+    vertices += leafCount * 4;
+  }
+
+  if (!parallel || ctx.Tasks.size() < 2 || vertices < ParallelMinVertices)
+  {
+    for (size_t i = 0; i < ctx.Tasks.size(); ++i)
+    {
+      RunExtractTask(&ctx, (int)i);
+    }
+    return true;
+  }
+
+  // Tasks fill separate meshes, a prefix sum over their sizes places them in the result
+  std::vector<TreeMesh> parts(ctx.Tasks.size());
+  for (size_t i = 0; i < ctx.Tasks.size(); ++i)
+  {
+    parts[i].Attributes = m.Attributes;
+    ctx.Tasks[i].Target = &parts[i];
+  }
+  ParallelFor((int)ctx.Tasks.size(), options.Threads, RunExtractTask, &ctx);
+
+  int vertexCount = 0;
+  int triangleCount = 0;
+  for (size_t i = 0; i < ctx.Tasks.size(); ++i)
+  {
+    ctx.Tasks[i].VertexOffset = vertexCount;
+    ctx.Tasks[i].TriangleOffset = triangleCount;
+    vertexCount += parts[i].GetVertexCount();
+    triangleCount += parts[i].GetTriangleCount();
+  }
+  m.Positions.resize((size_t)vertexCount * 3);
+  ResizeChannel(m.Normals, (m.Attributes & AttrNormals) != 0, (size_t)vertexCount * 3);
+  ResizeChannel(m.Binormals, (m.Attributes & AttrBinormals) != 0, (size_t)vertexCount * 3);
+  ResizeChannel(m.Tangents, (m.Attributes & AttrTangents) != 0, (size_t)vertexCount * 3);
+  ResizeChannel(m.Colors, (m.Attributes & AttrColors) != 0, (size_t)vertexCount * 4);
+  for (int uv = 0; uv < UVSetCount; ++uv)
+  {
+    ResizeChannel(m.UVs[uv], (m.Attributes & UVAttribute(uv)) != 0, (size_t)vertexCount * 2);
+  }
+  ResizeChannel(m.Wind, (m.Attributes & AttrWind) != 0, (size_t)vertexCount * 4);
+  m.Indices.resize((size_t)triangleCount * 3);
+  m.Materials.resize(triangleCount);
+  m.Groups.resize(triangleCount);
+  m.Elements.resize(triangleCount);
+  m.Sections.resize(triangleCount);
+  ParallelFor((int)ctx.Tasks.size(), options.Threads, CopyExtractTask, &ctx);
+  return true;
+}
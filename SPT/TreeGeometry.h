@@ -0,0 +1,126 @@
+#ifndef _TREE_GEOMETRY_H
+#define _TREE_GEOMETRY_H
+
+#include "TreeMesh.h"
+
+#include <vector>
+
+// Computed SpeedTree geometry without a dependency on SpeedTreeRT. Arrays point either
+// into CSpeedTreeRT::SGeometry or into a mapped geometry cache, the view owns nothing but
+// its tables. Coordinates are in SpeedTree space (y-up).
+
+struct IndexedLod
+{
+  int StripCount;
+  const int *StripLengths;
+  std::vector<const int *> Strips;
+};
+
+// Branches and fronds: vertices are shared by all LODs, strips select them
+struct IndexedGeometry
+{
+  IndexedGeometry()
+  {
+    VertexCount = 0;
+    Coords = Normals = Binormals = Tangents = TexCoords = NULL;
+    Colors = NULL;
+    for (int i = 0; i < 2; ++i)
+    {
+      WindWeights[i] = NULL;
+      WindMatrixIndices[i] = NULL;
+    }
+  }
+  int VertexCount;
+  const float *Coords;                      // xyz
+  const float *Normals;                     // xyz
+  const float *Binormals;                   // xyz
+  const float *Tangents;                    // xyz
+  const float *TexCoords;                   // diffuse uv
+  const unsigned int *Colors;               // rgba, may be NULL
+  const float *WindWeights[2];              // may be NULL
+  const unsigned char *WindMatrixIndices[2]; // may be NULL
+  std::vector<IndexedLod> Lods;
+};
+
+struct LeafMesh
+{
+  int VertexCount;
+  const float *Coords;    // xyz, relative to the leaf center
+  const float *Normals;
+  const float *Binormals;
+  const float *Tangents;
+  const float *TexCoords;
+  int IndexCount;
+  const int *Indices;     // triangle list
+};
+
+struct LeafCard
+{
+  float Width;
+  float Height;
+  float Pivot[2];
+  const float *Coords;    // 4 corners xyzw, relative to the leaf center
+  const float *TexCoords; // 4 corners uv
+  int Mesh;               // index into LeafLod::Meshes, -1 for a flat card
+};
+
+struct LeafLod
+{
+  LeafLod()
+  {
+    LeafCount = 0;
+    Centers = Normals = Binormals = Tangents = Dimming = NULL;
+    Colors = NULL;
+    CardIndices = NULL;
+    for (int i = 0; i < 2; ++i)
+    {
+      WindWeights[i] = NULL;
+      WindMatrixIndices[i] = NULL;
+    }
+  }
+  int LeafCount;
+  const float *Centers;                      // xyz per leaf
+  const float *Normals;                      // xyz per card corner
+  const float *Binormals;                    // xyz per card corner
+  const float *Tangents;                     // xyz per card corner
+  const unsigned int *Colors;                // rgba per card corner, may be NULL
+  const float *Dimming;                      // per leaf
+  const unsigned char *CardIndices;          // per leaf, into Cards
+  const float *WindWeights[2];               // per leaf, may be NULL
+  const unsigned char *WindMatrixIndices[2]; // per leaf, may be NULL
+  std::vector<LeafCard> Cards;
+  std::vector<LeafMesh> Meshes;
+};
+
+struct TreeGeometry
+{
+  TreeGeometry()
+  {
+    UserData = NULL;
+  }
+  const char *UserData; // may be NULL
+  IndexedGeometry Branches;
+  IndexedGeometry Fronds;
+  std::vector<LeafLod> Leaves;
+};
+
+struct ExtractOptions
+{
+  ExtractOptions()
+  {
+    Lod = 0;
+    Attributes = AttrAll;
+    Threads = 1;
+    Sections = AllSections;
+  }
+  int Lod;
+  unsigned int Attributes; // MeshAttribute mask of the vertex channels to fill
+  int Threads;             // Large trees are extracted by sections and leaf ranges in parallel
+  unsigned int Sections;   // Sections to extract, the others get no vertices, triangles or materials
+};
+
+// Converts the geometry of a LOD to the mesh that gets serialized. The result doesn't
+// depend on the number of threads.
+bool ExtractTree(TreeGeometry const &geometry, ExtractOptions const &options, TreeMesh &mesh);
+
+#endif // #ifndef _TREE_GEOMETRY_H
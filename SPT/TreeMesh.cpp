@@ -0,0 +1,141 @@
+#include "TreeMesh.h"
+
+struct NamedMask
+{
+  const char *Name;
+  unsigned int Mask;
+};
+
+// Leaf card shaders read the custom UV sets, engines that render leaves as plain
+// geometry only need the diffuse one.
+static const NamedMask Presets[] = {
+  { "full", AttrAll },
+  { "unreal", AttrAll & ~(AttrBinormals | AttrTangents) }, // Unreal imports normals and computes MikkTSpace tangents
+  { "unity", AttrAll & ~AttrBinormals }, // Unity rebuilds binormals from normals and tangents
+  { "static", AttrNormals | AttrBinormals | AttrTangents | AttrColors | AttrUV0 },
+  { "minimal", AttrNormals | AttrUV0 },
+};
+
+static const NamedMask Channels[] = {
+  { "pos", 0 },
+  { "normal", AttrNormals },
+  { "binormal", AttrBinormals },
+  { "tangent", AttrTangents },
+  { "color", AttrColors },
+  { "uv0", AttrUV0 << UVDiffuse },
+  { "uv1", AttrUV0 << UVSize },
+  { "uv2", AttrUV0 << UVCenterXY },
+  { "uv3", AttrUV0 << UVCenterZDimming },
+  { "uv4", AttrUV0 << UVPivot },
+  { "wind", AttrWind },
+};
+
+// leaves covers both kinds of leaf geometry
+static const NamedMask SectionNames[] = {
+  { "all", AllSections },
+  { "branches", 1 << SectionBranches },
+  { "fronds", 1 << SectionFronds },
+  { "leaves", (1 << SectionLeafCards) | (1 << SectionLeafMeshes) },
+  { "leaf-cards", 1 << SectionLeafCards },
+  { "leaf-meshes", 1 << SectionLeafMeshes },
+};
+
+static const NamedMask *FindName(NamedMask const *names, size_t count, std::string const &name)
+{
+  for (size_t i = 0; i < count; ++i)
+  {
+    if (name == names[i].Name)
+    {
+      return &names[i];
+    }
+  }
+  return NULL;
+}
+
+bool ParseAttributes(std::string const &spec, unsigned int &attributes)
+{
+  unsigned int result = 0;
+  size_t pos = 0;
+  while (pos <= spec.size())
+  {
+    size_t end = spec.find(',', pos);
+    if (end == std::string::npos)
+    {
+      end = spec.size();
+    }
+    const std::string name = spec.substr(pos, end - pos);
+    const NamedMask *entry = FindName(Presets, sizeof(Presets) / sizeof(Presets[0]), name);
+    if (!entry)
+    {
+      entry = FindName(Channels, sizeof(Channels) / sizeof(Channels[0]), name);
+    }
+    if (!entry)
+    {
+      return false;
+    }
+    result |= entry->Mask;
+    pos = end + 1;
+  }
+  attributes = result;
+  return true;
+}
+
+std::string FormatAttributes(unsigned int attributes)
+{
+  for (size_t i = 0; i < sizeof(Presets) / sizeof(Presets[0]); ++i)
+  {
+    if ((attributes & ~AttrWind) == Presets[i].Mask)
+    {
+      return std::string(Presets[i].Name) + (attributes & AttrWind ? ",wind" : "");
+    }
+  }
+  std::string result("pos");
+  for (size_t i = 1; i < sizeof(Channels) / sizeof(Channels[0]); ++i)
+  {
+    if (attributes & Channels[i].Mask)
+    {
+      result += ",";
+      result += Channels[i].Name;
+    }
+  }
+  return result;
+}
+
+bool ParseSections(std::string const &spec, unsigned int &sections)
+{
+  unsigned int result = 0;
+  size_t pos = 0;
+  while (pos <= spec.size())
+  {
+    size_t end = spec.find(',', pos);
+    if (end == std::string::npos)
+    {
+      end = spec.size();
+    }
+    const NamedMask *entry = FindName(SectionNames, sizeof(SectionNames) / sizeof(SectionNames[0]), spec.substr(pos, end - pos));
+    if (!entry)
+    {
+      return false;
+    }
+    result |= entry->Mask;
+    pos = end + 1;
+  }
+  sections = result;
+  return true;
+}
+
+std::string FormatSections(unsigned int sections)
+{
+  std::string result;
+  for (size_t i = 0; i < sizeof(SectionNames) / sizeof(SectionNames[0]); ++i)
+  {
+    const unsigned int bits = SectionNames[i].Mask;
+    if ((sections & bits) == bits)
+    {
+      result += result.empty() ? "" : ",";
+      result += SectionNames[i].Name;
+      sections &= ~bits;
+    }
+  }
+  return result;
+}
@@ -0,0 +1,100 @@
+#ifndef _TREE_MESH_H
+#define _TREE_MESH_H
+
+#include <string>
+#include <vector>
+
+enum MeshSection
+{
+  SectionBranches,
+  SectionFronds,
+  SectionLeafCards,
+  SectionLeafMeshes,
+  SectionCount
+};
+
+// Mask of 1 << MeshSection for partial exports
+const unsigned int AllSections = (1 << SectionCount) - 1;
+
+inline unsigned int SectionBit(int section)
+{
+  return 1u << section;
+}
+
+// Accepts a comma separated list of all, branches, fronds, leaves, leaf-cards and leaf-meshes
+bool ParseSections(std::string const &spec, unsigned int &sections);
+
+std::string FormatSections(unsigned int sections);
+
+enum MeshUVSet
+{
+  UVDiffuse,        // diffuse texture coordinates
+  UVSize,           // leaf card width, height
+  UVCenterXY,       // leaf card position x, y
+  UVCenterZDimming, // leaf card position z, leaf dimming
+  UVPivot,          // leaf card pivot u, v
+  UVSetCount
+};
+
+// Vertex channels besides positions, which are always exported
+enum MeshAttribute
+{
+  AttrNormals = 1 << 0,
+  AttrBinormals = 1 << 1,
+  AttrTangents = 1 << 2,
+  AttrColors = 1 << 3,
+  AttrUV0 = 1 << 4,                          // UV set n is AttrUV0 << n
+  AttrAll = (AttrUV0 << UVSetCount) - 1,
+  AttrWind = AttrUV0 << UVSetCount           // opt-in, not part of AttrAll
+};
+
+inline unsigned int UVAttribute(int uvSet)
+{
+  return AttrUV0 << uvSet;
+}
+
+// Accepts a comma separated list of presets (full, unreal, unity, static, minimal) and
+// channels (pos, normal, binormal, tangent, color, uv0..uv4, wind), e.g. "unity,wind"
+bool ParseAttributes(std::string const &spec, unsigned int &attributes);
+
+// Returns the name of the first matching preset (plus ",wind"), or the channel list
+std::string FormatAttributes(unsigned int attributes);
+
+// Triangulated tree geometry of a single LOD in export space (y is flipped).
+// This is what gets serialized, vertex and polygon order match the output file.
+struct TreeMesh
+{
+  TreeMesh()
+  {
+    Attributes = AttrAll;
+  }
+
+  // Channels that are not in Attributes stay empty
+  unsigned int Attributes;
+
+  // Per vertex. Positions and UVs are stored in double like the FBX SDK does. Values
+  // computed from SpeedTree floats (leaf corner + center) are summed in float first,
+  // as the exporter always did, so the output keeps its exact bits.
+  std::vector<double> Positions;       // xyz
+  std::vector<float> Normals;          // xyz
+  std::vector<float> Binormals;        // xyz
+  std::vector<float> Tangents;         // xyz
+  std::vector<unsigned char> Colors;   // rgba
+  std::vector<double> UVs[UVSetCount]; // uv
+  std::vector<float> Wind;             // weight and matrix index of wind levels 0 and 1
+
+  // Per triangle
+  std::vector<int> Indices;            // 3 vertex indices
+  std::vector<int> Materials;          // index into MaterialNames
+  std::vector<int> Groups;             // polygon group
+  std::vector<int> Elements;           // strip index for branches and fronds, leaf index for leaves
+  std::vector<unsigned char> Sections;
+
+  std::vector<std::string> MaterialNames;
+  std::vector<float> LeafCenters;      // xyz per leaf
+
+  int GetVertexCount() const { return (int)Positions.size() / 3; }
+  int GetTriangleCount() const { return (int)Indices.size() / 3; }
+};
+
+#endif // #ifndef _TREE_MESH_H
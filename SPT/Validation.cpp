@@ -0,0 +1,186 @@
+#include "Validation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+MeshStats::MeshStats()
+{
+  OutOfRangeTriangles = 0;
+  DegenerateTriangles = 0;
+  DuplicateTriangles = 0;
+  InvalidVertices = 0;
+  UnreferencedVertices = 0;
+  for (int k = 0; k < 3; ++k)
+  {
+    BoundsMin[k] = BoundsMax[k] = 0.;
+  }
+  SurfaceArea = 0.;
+  LeafArea = 0.;
+  TriangleDensity = 0.;
+  LeafOverdraw = 0.;
+}
+
+// False for NaN and infinities, without relying on _finite/isfinite
+template<typename T>
+inline bool IsFinite(T x)
+{
+  return x - x == 0;
+}
+
+template<typename T>
+inline bool IsFinite(std::vector<T> const &channel, int v, int size)
+{
+  for (int i = 0; !channel.empty() && i < size; ++i)
+  {
+    if (!IsFinite(channel[v * size + i]))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Vertices of a triangle rotated so the smallest index comes first, winding is kept
+struct TriangleKey
+{
+  int V[3];
+  bool operator<(TriangleKey const &o) const
+  {
+    return V[0] != o.V[0] ? V[0] < o.V[0] : V[1] != o.V[1] ? V[1] < o.V[1] : V[2] < o.V[2];
+  }
+  bool operator==(TriangleKey const &o) const
+  {
+    return V[0] == o.V[0] && V[1] == o.V[1] && V[2] == o.V[2];
+  }
+};
+
+void ValidateMesh(TreeMesh const &m, MeshStats &stats)
+{
+  stats = MeshStats();
+  const int vertexCount = m.GetVertexCount();
+  const int triangleCount = m.GetTriangleCount();
+
+  int bounded = 0;
+  for (int v = 0; v < vertexCount; ++v)
+  {
+    bool valid = IsFinite(m.Positions, v, 3) && IsFinite(m.Normals, v, 3) && IsFinite(m.Binormals, v, 3) && IsFinite(m.Tangents, v, 3) && IsFinite(m.Wind, v, 4);
+    for (int uv = 0; valid && uv < UVSetCount; ++uv)
+    {
+      valid = IsFinite(m.UVs[uv], v, 2);
+    }
+    if (!valid)
+    {
+      stats.InvalidVertices++;
+      continue;
+    }
+    const double *p = &m.Positions[v * 3];
+    for (int k = 0; k < 3; ++k)
+    {
+      stats.BoundsMin[k] = bounded ? std::min(stats.BoundsMin[k], p[k]) : p[k];
+      stats.BoundsMax[k] = bounded ? std::max(stats.BoundsMax[k], p[k]) : p[k];
+    }
+    bounded++;
+  }
+
+  std::vector<bool> referenced(vertexCount, false);
+  std::vector<TriangleKey> keys;
+  keys.reserve(triangleCount);
+  for (int t = 0; t < triangleCount; ++t)
+  {
+    const int *idx = &m.Indices[t * 3];
+    if (idx[0] < 0 || idx[1] < 0 || idx[2] < 0 || idx[0] >= vertexCount || idx[1] >= vertexCount || idx[2] >= vertexCount)
+    {
+      stats.OutOfRangeTriangles++;
+      continue;
+    }
+    for (int k = 0; k < 3; ++k)
+    {
+      referenced[idx[k]] = true;
+    }
+    const double *a = &m.Positions[idx[0] * 3];
+    const double *b = &m.Positions[idx[1] * 3];
+    const double *c = &m.Positions[idx[2] * 3];
+    const double e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+    const double e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+    const double n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+    const double cross = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+    const double edges = std::sqrt((e1[0] * e1[0] + e1[1] * e1[1] + e1[2] * e1[2]) * (e2[0] * e2[0] + e2[1] * e2[1] + e2[2] * e2[2]));
+    // Collinear within float precision counts as zero area whatever the scale of the tree
+    if (idx[0] == idx[1] || idx[1] == idx[2] || idx[0] == idx[2] || !(cross > edges * 1e-7))
+    {
+      stats.DegenerateTriangles++;
+      continue;
+    }
+    const double area = cross * .5;
+    stats.SurfaceArea += area;
+    if (m.Sections[t] == SectionLeafCards || m.Sections[t] == SectionLeafMeshes)
+    {
+      stats.LeafArea += area;
+    }
+    const int first = idx[0] < idx[1] ? (idx[0] < idx[2] ? 0 : 2) : (idx[1] < idx[2] ? 1 : 2);
+    TriangleKey key;
+    for (int k = 0; k < 3; ++k)
+    {
+      key.V[k] = idx[(first + k) % 3];
+    }
+    keys.push_back(key);
+  }
+
+  std::sort(keys.begin(), keys.end());
+  for (size_t i = 1; i < keys.size(); ++i)
+  {
+    if (keys[i] == keys[i - 1])
+    {
+      stats.DuplicateTriangles++;
+    }
+  }
+  stats.UnreferencedVertices = (int)std::count(referenced.begin(), referenced.end(), false);
+
+  if (stats.SurfaceArea > 0.)
+  {
+    stats.TriangleDensity = triangleCount / stats.SurfaceArea;
+  }
+  // Export space is z-up, a side view sees the wider horizontal extent times the height
+  const double width = std::max(stats.BoundsMax[0] - stats.BoundsMin[0], stats.BoundsMax[1] - stats.BoundsMin[1]);
+  const double silhouette = width * (stats.BoundsMax[2] - stats.BoundsMin[2]);
+  if (silhouette > 0.)
+  {
+    stats.LeafOverdraw = stats.LeafArea / silhouette;
+  }
+}
+
+void DescribeProblems(MeshStats const &stats, std::vector<std::string> &problems)
+{
+  char buf[128];
+  if (stats.OutOfRangeTriangles)
+  {
+    sprintf(buf, "%d triangles with out of range indices", stats.OutOfRangeTriangles);
+    problems.push_back(buf);
+  }
+  if (stats.InvalidVertices)
+  {
+    sprintf(buf, "%d vertices with NaN or infinite values", stats.InvalidVertices);
+    problems.push_back(buf);
+  }
+}
+
+void CheckBudget(MeshBudget const &budget, int vertices, int triangles, unsigned long long bytes, std::vector<std::string> &problems)
+{
+  char buf[128];
+  if (budget.MaxTriangles && triangles > budget.MaxTriangles)
+  {
+    sprintf(buf, "%d triangles exceed the budget of %d", triangles, budget.MaxTriangles);
+    problems.push_back(buf);
+  }
+  if (budget.MaxVertices && vertices > budget.MaxVertices)
+  {
+    sprintf(buf, "%d vertices exceed the budget of %d", vertices, budget.MaxVertices);
+    problems.push_back(buf);
+  }
+  if (budget.MaxBytes && bytes > budget.MaxBytes)
+  {
+    sprintf(buf, "%llu bytes exceed the budget of %llu", bytes, budget.MaxBytes);
+    problems.push_back(buf);
+  }
+}
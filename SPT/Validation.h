@@ -0,0 +1,51 @@
+#ifndef _VALIDATION_H
+#define _VALIDATION_H
+
+#include "TreeMesh.h"
+
+#include <string>
+#include <vector>
+
+// Problems and geometric statistics of an extracted mesh
+struct MeshStats
+{
+  MeshStats();
+  int OutOfRangeTriangles;  // reference a vertex that doesn't exist
+  int DegenerateTriangles;  // repeated vertex or zero area, e.g. strip joins
+  int DuplicateTriangles;   // same vertices and winding as an earlier triangle
+  int InvalidVertices;      // NaN or infinite position or attribute
+  int UnreferencedVertices;
+  double BoundsMin[3];
+  double BoundsMax[3];
+  double SurfaceArea;       // all triangles, one side
+  double LeafArea;          // leaf cards and leaf meshes, one side
+  double TriangleDensity;   // triangles per square unit of surface
+  double LeafOverdraw;      // leaf area over the side silhouette of the bounds: leaf layers a side view crosses
+};
+
+// Per asset limits, 0 means unlimited
+struct MeshBudget
+{
+  MeshBudget()
+  {
+    MaxTriangles = 0;
+    MaxVertices = 0;
+    MaxBytes = 0;
+    Fail = false;
+  }
+  int MaxTriangles;
+  int MaxVertices;
+  unsigned long long MaxBytes; // size of the output file
+  bool Fail;                   // exceeding a limit or invalid geometry fails the export instead of warning
+};
+
+void ValidateMesh(TreeMesh const &mesh, MeshStats &stats);
+
+// Appends a message per problem that breaks the output: out of range indices and invalid numbers.
+// Degenerate, duplicate and unreferenced elements are only counted.
+void DescribeProblems(MeshStats const &stats, std::vector<std::string> &problems);
+
+// Appends a message per exceeded limit. Pass bytes = 0 to skip the size check before saving.
+void CheckBudget(MeshBudget const &budget, int vertices, int triangles, unsigned long long bytes, std::vector<std::string> &problems);
+
+#endif // #ifndef _VALIDATION_H
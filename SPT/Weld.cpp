@@ -0,0 +1,202 @@
+#include "Weld.h"
+
+#include <algorithm>
+#include <cmath>
+
+struct WeldEntry
+{
+  int Material;
+  unsigned long long Hash;
+  int Vertex;
+  bool operator<(WeldEntry const &o) const
+  {
+    return Material != o.Material ? Material < o.Material : Hash != o.Hash ? Hash < o.Hash : Vertex < o.Vertex;
+  }
+};
+
+// Channel values rounded to the welding grid, -0 and 0 give the same key
+template<typename T>
+inline void AddKeys(std::vector<T> const &channel, int v, int size, double epsilon, std::vector<double> &key)
+{
+  for (int i = 0; !channel.empty() && i < size; ++i)
+  {
+    double x = (double)channel[v * size + i];
+    x = epsilon > 0. ? std::floor(x / epsilon + .5) : x;
+    key.push_back(x == 0. ? 0. : x);
+  }
+}
+
+static void GetKey(TreeMesh const &m, int v, double epsilon, std::vector<double> &key)
+{
+  key.clear();
+  AddKeys(m.Positions, v, 3, epsilon, key);
+  AddKeys(m.Normals, v, 3, epsilon, key);
+  AddKeys(m.Binormals, v, 3, epsilon, key);
+  AddKeys(m.Tangents, v, 3, epsilon, key);
+  AddKeys(m.Colors, v, 4, 0., key);
+  for (int uv = 0; uv < UVSetCount; ++uv)
+  {
+    AddKeys(m.UVs[uv], v, 2, epsilon, key);
+  }
+  AddKeys(m.Wind, v, 4, epsilon, key);
+}
+
+// FNV-1a over the key bytes
+static unsigned long long HashKey(std::vector<double> const &key)
+{
+  unsigned long long hash = 14695981039346656037ULL;
+  const unsigned char *bytes = key.empty() ? NULL : (const unsigned char *)&key[0];
+  for (size_t i = 0; i < key.size() * sizeof(double); ++i)
+  {
+    hash = (hash ^ bytes[i]) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+// Moves the kept vertices to the front, keep is sorted
+template<typename T>
+inline void CompactChannel(std::vector<T> &channel, std::vector<int> const &keep, int size)
+{
+  if (channel.empty())
+  {
+    return;
+  }
+  for (size_t i = 0; i < keep.size(); ++i)
+  {
+    std::copy(&channel[keep[i] * size], &channel[keep[i] * size] + size, &channel[i * size]);
+  }
+  channel.resize(keep.size() * size);
+}
+
+int WeldVertices(TreeMesh &m, double epsilon)
+{
+  const int vertexCount = m.GetVertexCount();
+  const int triangleCount = m.GetTriangleCount();
+
+  // Vertices shared by several materials only weld with each other
+  const int unreferenced = -1;
+  const int mixed = -2;
+  std::vector<int> materials(vertexCount, unreferenced);
+  for (int t = 0; t < triangleCount; ++t)
+  {
+    for (int k = 0; k < 3; ++k)
+    {
+      int &material = materials[m.Indices[t * 3 + k]];
+      material = material == unreferenced || material == m.Materials[t] ? m.Materials[t] : mixed;
+    }
+  }
+
+  std::vector<WeldEntry> entries;
+  entries.reserve(vertexCount);
+  std::vector<double> key;
+  for (int v = 0; v < vertexCount; ++v)
+  {
+    if (materials[v] != unreferenced)
+    {
+      GetKey(m, v, epsilon, key);
+      WeldEntry entry;
+      entry.Material = materials[v];
+      entry.Hash = HashKey(key);
+      entry.Vertex = v;
+      entries.push_back(entry);
+    }
+  }
+  std::sort(entries.begin(), entries.end());
+
+  // Within a run of equal hashes the lowest vertex of every distinct key survives
+  std::vector<int> remap(vertexCount, -1);
+  std::vector<std::vector<double> > keys;
+  std::vector<int> survivors;
+  for (size_t begin = 0, end = 0; begin < entries.size(); begin = end)
+  {
+    end = begin + 1;
+    while (end < entries.size() && entries[end].Material == entries[begin].Material && entries[end].Hash == entries[begin].Hash)
+    {
+      end++;
+    }
+    if (end - begin == 1)
+    {
+      remap[entries[begin].Vertex] = entries[begin].Vertex;
+      continue;
+    }
+    keys.clear();
+    survivors.clear();
+    for (size_t i = begin; i < end; ++i)
+    {
+      const int v = entries[i].Vertex;
+      GetKey(m, v, epsilon, key);
+      size_t match = 0;
+      while (match < keys.size() && keys[match] != key)
+      {
+        match++;
+      }
+      if (match == keys.size())
+      {
+        keys.push_back(key);
+        survivors.push_back(v);
+      }
+      remap[v] = survivors[match];
+    }
+  }
+
+  // Triangles whose corners now share a vertex have no area left, later triangles move up
+  int triangles = 0;
+  std::vector<bool> referenced(vertexCount, false);
+  for (int t = 0; t < triangleCount; ++t)
+  {
+    const int a = remap[m.Indices[t * 3]];
+    const int b = remap[m.Indices[t * 3 + 1]];
+    const int c = remap[m.Indices[t * 3 + 2]];
+    if (a == b || b == c || a == c)
+    {
+      continue;
+    }
+    m.Indices[triangles * 3] = a;
+    m.Indices[triangles * 3 + 1] = b;
+    m.Indices[triangles * 3 + 2] = c;
+    m.Materials[triangles] = m.Materials[t];
+    m.Groups[triangles] = m.Groups[t];
+    m.Elements[triangles] = m.Elements[t];
+    m.Sections[triangles] = m.Sections[t];
+    referenced[a] = referenced[b] = referenced[c] = true;
+    triangles++;
+  }
+
+  int welded = 0;
+  std::vector<int> keep;
+  std::vector<int> newIndex(vertexCount, -1);
+  for (int v = 0; v < vertexCount; ++v)
+  {
+    welded += remap[v] != -1 && remap[v] != v;
+    if (referenced[v])
+    {
+      newIndex[v] = (int)keep.size();
+      keep.push_back(v);
+    }
+  }
+  if ((int)keep.size() == vertexCount && triangles == triangleCount)
+  {
+    return 0;
+  }
+
+  m.Indices.resize(triangles * 3);
+  m.Materials.resize(triangles);
+  m.Groups.resize(triangles);
+  m.Elements.resize(triangles);
+  m.Sections.resize(triangles);
+  for (size_t i = 0; i < m.Indices.size(); ++i)
+  {
+    m.Indices[i] = newIndex[m.Indices[i]];
+  }
+  CompactChannel(m.Positions, keep, 3);
+  CompactChannel(m.Normals, keep, 3);
+  CompactChannel(m.Binormals, keep, 3);
+  CompactChannel(m.Tangents, keep, 3);
+  CompactChannel(m.Colors, keep, 4);
+  for (int uv = 0; uv < UVSetCount; ++uv)
+  {
+    CompactChannel(m.UVs[uv], keep, 2);
+  }
+  CompactChannel(m.Wind, keep, 4);
+  return welded;
+}
@@ -0,0 +1,12 @@
+#ifndef _WELD_H
+#define _WELD_H
+
+#include "TreeMesh.h"
+
+// Merges vertices of the same material whose channels all match after rounding to a
+// multiple of epsilon (0: exact matches only). Vertices keep the order of their first
+// occurrence. Triangles that collapse to a repeated vertex and vertices no triangle uses
+// are dropped as well. Returns the number of vertices merged into another one.
+int WeldVertices(TreeMesh &mesh, double epsilon);
+
+#endif // #ifndef _WELD_H